@@ -0,0 +1,237 @@
+#include "common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+int use_proc_ctl = 0;
+
+int building_handle = 0;
+char ctl_path[MAX_PATH] = PROC_DIR "/" DEFAULT_BUILDING "/status";
+char stats_path[MAX_PATH] = PROC_DIR "/" DEFAULT_BUILDING "/stats";
+char locks_path[MAX_PATH] = PROC_DIR "/" DEFAULT_BUILDING "/locks";
+
+
+/* the handle is the first line of the building's stats */
+int select_building(const char * name)
+{
+	struct elevator_stats stats;
+
+	snprintf(ctl_path, MAX_PATH, "%s/%s/status", PROC_DIR, name);
+	snprintf(stats_path, MAX_PATH, "%s/%s/stats", PROC_DIR, name);
+	snprintf(locks_path, MAX_PATH, "%s/%s/locks", PROC_DIR, name);
+
+	if (read_stats(&stats) != 0)
+		return -1;
+
+	building_handle = stat_get(&stats, "handle");
+	return building_handle < 0 ? -1 : 0;
+}
+
+
+int ctl_write(const char * cmds, size_t len)
+{
+	int fd = open(ctl_path, O_WRONLY);
+	ssize_t ret;
+
+	if (fd < 0)
+		return -1;
+
+	ret = write(fd, cmds, len);
+	close(fd);
+
+	return ret == (ssize_t)len ? 0 : -1;
+}
+
+
+long start_elevator(void)
+{
+	if (use_proc_ctl)
+		return ctl_write("start\n", 6);
+
+	return syscall(__NR_START_ELEVATOR, building_handle);
+}
+
+
+long issue_request(int p_type, int start_floor, int dest_floor)
+{
+	char cmd[32];
+	int len;
+
+	if (use_proc_ctl)
+	{
+		len = snprintf(cmd, sizeof(cmd), "req %d %d %d\n", p_type,
+			       start_floor, dest_floor);
+		return ctl_write(cmd, len);
+	}
+
+	return syscall(__NR_ISSUE_REQUEST, building_handle, p_type, start_floor,
+		       dest_floor);
+}
+
+
+/* through /proc, "stop" does not wait for the car to empty, so the
+ * wait that stop_elevator() does is done here
+ */
+long stop_elevator(void)
+{
+	struct elevator_stats stats;
+	long long state;
+
+	if (!use_proc_ctl)
+		return syscall(__NR_STOP_ELEVATOR, building_handle);
+
+	if (ctl_write("stop\n", 5) != 0)
+		return -1;
+
+	do
+	{
+		sleep_ns(100000000ULL);
+		if (read_stats(&stats) != 0)
+			return -1;
+		state = stat_get(&stats, "offline");
+	}
+	while (state == 0);
+
+	return 0;
+}
+
+
+/*************************************************************************/
+
+
+int read_stats(struct elevator_stats * stats)
+{
+	FILE * f = fopen(stats_path, "r");
+	char line[128];
+	struct stat_entry * e;
+
+	if (f == NULL)
+		return -1;
+
+	stats->count = 0;
+
+	while (fgets(line, sizeof(line), f) != NULL && stats->count < MAX_STATS)
+	{
+		e = &stats->entries[stats->count];
+
+		if (sscanf(line, "%31[^:]: %lld", e->key, &e->value) == 2)
+			stats->count++;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+
+long long stat_get(const struct elevator_stats * stats, const char * key)
+{
+	int i;
+
+	for (i = 0; i < stats->count; i++)
+	{
+		if (strcmp(stats->entries[i].key, key) == 0)
+			return stats->entries[i].value;
+	}
+
+	return -1;
+}
+
+
+int read_lock_profile(struct lock_profile * profile)
+{
+	FILE * f = fopen(locks_path, "r");
+	char line[256];
+	struct lock_site * site;
+
+	if (f == NULL)
+		return -1;
+
+	profile->count = 0;
+
+	while (fgets(line, sizeof(line), f) != NULL &&
+	       profile->count < MAX_STATS)
+	{
+		site = &profile->sites[profile->count];
+
+		// the header line does not parse, so it is skipped
+		if (sscanf(line, "%31s %llu %llu %llu %llu %llu %llu", site->name,
+			   &site->acquired, &site->interrupted, &site->wait_ns,
+			   &site->wait_max_ns, &site->hold_ns,
+			   &site->hold_max_ns) == 7)
+			profile->count++;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+
+/*************************************************************************/
+
+
+uint64_t now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+
+void sleep_ns(uint64_t ns)
+{
+	struct timespec t;
+
+	t.tv_sec = ns / 1000000000ULL;
+	t.tv_nsec = ns % 1000000000ULL;
+
+	while (nanosleep(&t, &t) != 0 && errno == EINTR)
+		;
+}
+
+
+uint64_t rng_next(uint64_t * state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+
+	*state = x;
+	return x;
+}
+
+
+double rng_uniform(uint64_t * state)
+{
+	return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+int rng_range(uint64_t * state, int lo, int hi)
+{
+	return lo + (int)(rng_next(state) % (uint64_t)(hi - lo + 1));
+}
+
+
+/*************************************************************************/
+
+
+FILE * csv_open(const char * path, const char * header)
+{
+	FILE * f = fopen(path, "a");
+
+	if (f == NULL)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	if (ftell(f) == 0)
+		fprintf(f, "%s\n", header);
+
+	return f;
+}
@@ -0,0 +1,121 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* System call numbers of the elevator system calls, as added to the
+ * kernel's syscall table; override with -D if your table differs
+ */
+#ifndef __NR_START_ELEVATOR
+#define __NR_START_ELEVATOR 333
+#endif
+
+#ifndef __NR_ISSUE_REQUEST
+#define __NR_ISSUE_REQUEST 334
+#endif
+
+#ifndef __NR_STOP_ELEVATOR
+#define __NR_STOP_ELEVATOR 335
+#endif
+
+#ifndef __NR_ELEVATOR_ETA
+#define __NR_ELEVATOR_ETA 336
+#endif
+
+/* every building the module simulates has its own directory here */
+#define PROC_DIR "/proc/elevator"
+#define DEFAULT_BUILDING "default"
+
+#define NUM_FLOORS 10
+#define MAX_STATS 64
+#define MAX_PATH 128
+
+/* One "key: value" line of a building's stats file */
+struct stat_entry
+{
+	char key[32];
+	long long value;
+};
+
+struct elevator_stats
+{
+	int count;
+	struct stat_entry entries[MAX_STATS];
+};
+
+/* One lock site line of a building's locks file */
+struct lock_site
+{
+	char name[32];
+	unsigned long long acquired;
+	unsigned long long interrupted;
+	unsigned long long wait_ns;
+	unsigned long long wait_max_ns;
+	unsigned long long hold_ns;
+	unsigned long long hold_max_ns;
+};
+
+struct lock_profile
+{
+	int count;
+	struct lock_site sites[MAX_STATS];
+};
+
+/* when set, the wrappers below write commands to the building's
+ * status file instead of making the elevator system calls (for stock
+ * kernels)
+ */
+extern int use_proc_ctl;
+
+/* the building everything below acts on, set by select_building() */
+extern int building_handle;
+extern char ctl_path[MAX_PATH];
+extern char stats_path[MAX_PATH];
+extern char locks_path[MAX_PATH];
+
+/* points the wrappers below at the building called name, looking up
+ * its system call handle; returns 0 on success
+ */
+int select_building(const char * name);
+
+/* thin wrappers around the elevator system calls */
+long start_elevator(void);
+long issue_request(int p_type, int start_floor, int dest_floor);
+long stop_elevator(void);
+
+/* writes a batch of newline-separated commands to the status file in
+ * a single write(); returns 0 on success
+ */
+int ctl_write(const char * cmds, size_t len);
+
+/* reads the stats file into stats; returns 0 on success */
+int read_stats(struct elevator_stats * stats);
+
+/* returns the value stored under key, or -1 if it is missing */
+long long stat_get(const struct elevator_stats * stats, const char * key);
+
+/* reads the locks file into profile; returns 0 on success */
+int read_lock_profile(struct lock_profile * profile);
+
+/* monotonic clock in nanoseconds */
+uint64_t now_ns(void);
+
+/* sleeps for the given number of nanoseconds */
+void sleep_ns(uint64_t ns);
+
+/* xorshift generator, cheap enough to keep one per thread */
+uint64_t rng_next(uint64_t * state);
+
+/* uniform double in [0, 1) */
+double rng_uniform(uint64_t * state);
+
+/* uniform integer in [lo, hi] */
+int rng_range(uint64_t * state, int lo, int hi);
+
+/* opens path for appending CSV rows, writing header first if the
+ * file is new or empty
+ */
+FILE * csv_open(const char * path, const char * header);
+
+#endif
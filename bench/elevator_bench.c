@@ -0,0 +1,386 @@
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+/* Traffic-pattern benchmark for the elevator module.
+ *
+ * Starts the elevator, runs a number of driver threads that issue
+ * requests through issue_request() with Poisson arrivals following one
+ * of the canonical building traffic patterns, waits for the car to
+ * drain, then appends one CSV row built from the building's stats
+ * file.
+ *
+ * usage: elevator_bench.x [-p pattern] [-r rate] [-d secs] [-t threads]
+ *                         [-s seed] [-w drain_secs] [-o file.csv]
+ *                         [-b building] [-P]
+ *
+ * -b runs against another building than the default one, so several
+ * copies can run side by side; -P sends commands through the
+ * building's status file instead of the system calls
+ */
+
+enum Pattern { UP_PEAK, DOWN_PEAK, LUNCH, UNIFORM };
+
+static const char * pattern_names[] = { "uppeak", "downpeak", "lunch",
+					"uniform" };
+
+/* share of trips touching the lobby (floor 1) in each pattern */
+#define PEAK_LOBBY_SHARE 0.85
+#define LUNCH_LOBBY_SHARE 0.90
+
+#define CSV_HEADER "time,pattern,rate_per_s,threads,duration_s,issued," \
+	"rejected,delivered,throughput_per_min,wait_mean_ms,wait_p99_ms," \
+	"ride_mean_ms,ride_p99_ms,utilization,busy_fraction,stops," \
+	"dwell_saved_ms,building,max_wait_ms,starved_runs,fairness," \
+	"floors_per_delivery,idle_fraction,empty_floor_fraction," \
+	"energy_per_delivery_j,wakeup_late_p99_us"
+
+struct options
+{
+	enum Pattern pattern;
+	double rate;
+	int duration;
+	int threads;
+	int drain;
+	unsigned long long seed;
+	const char * csv;
+	const char * building;
+};
+
+struct driver
+{
+	pthread_t thread;
+	const struct options * opts;
+	uint64_t rng;
+	uint64_t deadline;
+	long issued;
+	long failed;
+};
+
+
+/*************************************************************************/
+
+
+/* interfloor_trip() picks a uniformly random trip between two
+ * distinct floors
+ */
+static void interfloor_trip(uint64_t * rng, int * src, int * dst)
+{
+	*src = rng_range(rng, 1, NUM_FLOORS);
+
+	do
+		*dst = rng_range(rng, 1, NUM_FLOORS);
+	while (*dst == *src);
+}
+
+
+/* next_trip() draws a (src, dst) pair from the requested pattern */
+static void next_trip(enum Pattern pattern, uint64_t * rng, int * src,
+		      int * dst)
+{
+	double u = rng_uniform(rng);
+
+	switch (pattern)
+	{
+		case UP_PEAK:
+		{
+			if (u < PEAK_LOBBY_SHARE)
+			{
+				*src = 1;
+				*dst = rng_range(rng, 2, NUM_FLOORS);
+			}
+			else
+				interfloor_trip(rng, src, dst);
+			break;
+		}
+
+		case DOWN_PEAK:
+		{
+			if (u < PEAK_LOBBY_SHARE)
+			{
+				*src = rng_range(rng, 2, NUM_FLOORS);
+				*dst = 1;
+			}
+			else
+				interfloor_trip(rng, src, dst);
+			break;
+		}
+
+		case LUNCH:
+		{
+			if (u < LUNCH_LOBBY_SHARE / 2)
+			{
+				*src = 1;
+				*dst = rng_range(rng, 2, NUM_FLOORS);
+			}
+			else if (u < LUNCH_LOBBY_SHARE)
+			{
+				*src = rng_range(rng, 2, NUM_FLOORS);
+				*dst = 1;
+			}
+			else
+				interfloor_trip(rng, src, dst);
+			break;
+		}
+
+		case UNIFORM:
+		{
+			interfloor_trip(rng, src, dst);
+			break;
+		}
+	}
+}
+
+
+/* driver_run() issues requests with exponentially distributed gaps
+ * until the deadline passes
+ */
+static void * driver_run(void * arg)
+{
+	struct driver * d = arg;
+	double per_thread_rate = d->opts->rate / d->opts->threads;
+	uint64_t next = now_ns();
+	uint64_t now;
+	int src = 1, dst = 1;
+
+	while (1)
+	{
+		next += (uint64_t)(-log(1.0 - rng_uniform(&d->rng)) /
+				   per_thread_rate * 1e9);
+
+		if (next >= d->deadline)
+			break;
+
+		now = now_ns();
+		if (next > now)
+			sleep_ns(next - now);
+
+		next_trip(d->opts->pattern, &d->rng, &src, &dst);
+
+		if (issue_request(rng_range(&d->rng, 1, 4), src, dst) == 0)
+			d->issued++;
+		else
+			d->failed++;
+	}
+
+	return NULL;
+}
+
+
+/*************************************************************************/
+
+
+/* drain() waits until nobody is waiting or riding, or until the
+ * timeout expires; returns 0 if the car drained, 1 on a timeout and
+ * -1 if the stats could not be read. stats holds the last read
+ * unless -1 is returned
+ */
+static int drain(int timeout, struct elevator_stats * stats)
+{
+	uint64_t deadline = now_ns() + (uint64_t)timeout * 1000000000ULL;
+
+	do
+	{
+		if (read_stats(stats) != 0)
+			return -1;
+
+		if (stat_get(stats, "waiting") == 0 &&
+		    stat_get(stats, "riding") == 0)
+			return 0;
+
+		sleep_ns(250000000ULL);
+	}
+	while (now_ns() < deadline);
+
+	return 1;
+}
+
+
+static void write_row(FILE * f, const struct options * opts,
+		      const struct elevator_stats * stats)
+{
+	long long delivered = stat_get(stats, "delivered");
+	long long boarded = stat_get(stats, "boarded");
+	long long online = stat_get(stats, "online_ms");
+	long long busy = stat_get(stats, "busy_ms");
+	long long load = stat_get(stats, "load_unit_ms");
+	long long capacity = stat_get(stats, "capacity_units");
+	long long moved = stat_get(stats, "floors_moved");
+	double minutes = online / 60000.0;
+
+	fprintf(f, "%ld,%s,%.3f,%d,%d,%lld,%lld,%lld,%.3f,%.1f,%lld,%.1f,%lld,"
+		"%.4f,%.4f,%lld,%lld,%s,%lld,%lld,%.3f,%.3f,%.4f,%.4f,%.3f,%lld\n",
+		(long)time(NULL), pattern_names[opts->pattern], opts->rate,
+		opts->threads, opts->duration,
+		stat_get(stats, "issued"), stat_get(stats, "rejected"),
+		delivered,
+		minutes > 0 ? delivered / minutes : 0.0,
+		boarded > 0 ?
+			(double)stat_get(stats, "wait_total_ms") / boarded : 0.0,
+		stat_get(stats, "wait_p99_ms"),
+		delivered > 0 ?
+			(double)stat_get(stats, "ride_total_ms") / delivered : 0.0,
+		stat_get(stats, "ride_p99_ms"),
+		online > 0 ? (double)load / (capacity * online) : 0.0,
+		online > 0 ? (double)busy / online : 0.0,
+		stat_get(stats, "stops"), stat_get(stats, "dwell_saved_ms"),
+		opts->building, stat_get(stats, "max_wait_ms"),
+		stat_get(stats, "starved_runs"),
+		stat_get(stats, "fairness_permille") / 1000.0,
+		stat_get(stats, "floors_per_delivery_milli") / 1000.0,
+		online > 0 ? (double)stat_get(stats, "idle_ms") / online : 0.0,
+		moved > 0 ? (double)stat_get(stats, "floors_empty") / moved : 0.0,
+		stat_get(stats, "energy_per_delivery_mj") / 1000.0,
+		stat_get(stats, "wakeup_late_p99_us"));
+}
+
+
+static void usage(const char * prog)
+{
+	fprintf(stderr,
+		"usage: %s [-p uppeak|downpeak|lunch|uniform] [-r rate_per_s]\n"
+		"          [-d secs] [-t threads] [-s seed] [-w drain_secs]\n"
+		"          [-o file.csv] [-b building] [-P]\n"
+		"  -b  building under /proc/elevator to drive (default: %s)\n"
+		"  -P  drive the elevator through its status file\n", prog,
+		DEFAULT_BUILDING);
+	exit(1);
+}
+
+
+static void parse_options(int argc, char ** argv, struct options * opts)
+{
+	int c;
+	int i;
+
+	opts->pattern = UNIFORM;
+	opts->rate = 0.5;
+	opts->duration = 60;
+	opts->threads = 4;
+	opts->drain = 600;
+	opts->seed = (unsigned long long)time(NULL);
+	opts->csv = "elevator_bench.csv";
+	opts->building = DEFAULT_BUILDING;
+
+	while ((c = getopt(argc, argv, "p:r:d:t:s:w:o:b:Ph")) != -1)
+	{
+		switch (c)
+		{
+			case 'p':
+			{
+				for (i = 0; i < 4; i++)
+				{
+					if (strcmp(optarg, pattern_names[i]) == 0)
+						break;
+				}
+
+				if (i == 4)
+					usage(argv[0]);
+
+				opts->pattern = i;
+				break;
+			}
+
+			case 'r': opts->rate = atof(optarg); break;
+			case 'd': opts->duration = atoi(optarg); break;
+			case 't': opts->threads = atoi(optarg); break;
+			case 's': opts->seed = strtoull(optarg, NULL, 0); break;
+			case 'w': opts->drain = atoi(optarg); break;
+			case 'o': opts->csv = optarg; break;
+			case 'b': opts->building = optarg; break;
+			case 'P': use_proc_ctl = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (opts->rate <= 0 || opts->duration <= 0 || opts->threads <= 0)
+		usage(argv[0]);
+}
+
+
+/*************************************************************************/
+
+
+int main(int argc, char ** argv)
+{
+	struct options opts;
+	struct driver * drivers;
+	struct elevator_stats stats;
+	uint64_t deadline;
+	long issued = 0;
+	long failed = 0;
+	FILE * csv;
+	int drained;
+	int i;
+
+	parse_options(argc, argv, &opts);
+
+	if (select_building(opts.building) != 0)
+	{
+		perror(stats_path);
+		return 1;
+	}
+
+	if (start_elevator() != 0)
+	{
+		fprintf(stderr, "start_elevator failed; is the module loaded "
+			"and the elevator offline?\n");
+		return 1;
+	}
+
+	drivers = calloc(opts.threads, sizeof(*drivers));
+	deadline = now_ns() + (uint64_t)opts.duration * 1000000000ULL;
+
+	for (i = 0; i < opts.threads; i++)
+	{
+		drivers[i].opts = &opts;
+		drivers[i].rng = opts.seed * 2654435761ULL + i + 1;
+		drivers[i].deadline = deadline;
+		pthread_create(&drivers[i].thread, NULL, driver_run, &drivers[i]);
+	}
+
+	for (i = 0; i < opts.threads; i++)
+	{
+		pthread_join(drivers[i].thread, NULL);
+		issued += drivers[i].issued;
+		failed += drivers[i].failed;
+	}
+
+	drained = drain(opts.drain, &stats);
+	if (drained > 0)
+		fprintf(stderr, "warning: car did not drain within %d s\n",
+			opts.drain);
+
+	stop_elevator();
+
+	// no row from stats that were never read
+	if (drained < 0 && read_stats(&stats) != 0)
+	{
+		perror(stats_path);
+		free(drivers);
+		return 1;
+	}
+
+	csv = csv_open(opts.csv, CSV_HEADER);
+	if (csv == NULL)
+	{
+		perror(opts.csv);
+		return 1;
+	}
+
+	write_row(csv, &opts, &stats);
+	fclose(csv);
+
+	printf("%s: %ld requests issued, %ld refused, %lld delivered\n",
+	       pattern_names[opts.pattern], issued, failed,
+	       stat_get(&stats, "delivered"));
+
+	free(drivers);
+	return 0;
+}
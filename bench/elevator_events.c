@@ -0,0 +1,316 @@
+#include <errno.h>
+#include <getopt.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "../elevator/elevator_netlink.h"
+
+/* Event listener for the elevator module.
+ *
+ * Subscribes to the "events" multicast group of the "elevator"
+ * generic netlink family and prints one line per event, with the
+ * delay between the module timestamping the event and this process
+ * receiving it. Any libnl-based tool can subscribe the same way.
+ *
+ * usage: elevator_events.x [-b building] [-n count]
+ *
+ * -b only shows events of one building, -n exits after that many
+ */
+
+static const char * event_names[NUM_ELEVATOR_EVENTS] =
+{
+	"unspec", "state", "arrive", "board", "alight", "request"
+};
+
+static const char * state_names[] =
+{
+	"OFFLINE", "IDLE", "LOADING", "UP", "DOWN"
+};
+
+#define BUF_SIZE 8192
+
+/* room for a generic netlink request with one short attribute */
+struct genl_request
+{
+	struct nlmsghdr n;
+	struct genlmsghdr g;
+	char attrs[64];
+};
+
+
+/*************************************************************************/
+
+
+static struct nlattr * attr_next(struct nlattr * a)
+{
+	return (struct nlattr *)((char *)a + NLA_ALIGN(a->nla_len));
+}
+
+
+/* parse_attrs() indexes the attributes in [a, a + len) by type into
+ * tb, which has room for max + 1 entries
+ */
+static void parse_attrs(struct nlattr * a, int len, struct nlattr ** tb,
+			int max)
+{
+	memset(tb, 0, sizeof(*tb) * (max + 1));
+
+	while (len >= (int)sizeof(*a) && a->nla_len >= sizeof(*a) &&
+	       a->nla_len <= len)
+	{
+		if ((a->nla_type & NLA_TYPE_MASK) <= max)
+			tb[a->nla_type & NLA_TYPE_MASK] = a;
+
+		len -= NLA_ALIGN(a->nla_len);
+		a = attr_next(a);
+	}
+}
+
+
+static void * attr_data(struct nlattr * a)
+{
+	return (char *)a + NLA_HDRLEN;
+}
+
+
+/* resolve_family() asks the generic netlink controller for the
+ * elevator family's id and the id of its events group; returns 0 on
+ * success
+ */
+static int resolve_family(int fd, int * family, int * group)
+{
+	struct genl_request req;
+	struct nlattr * a;
+	struct nlattr * tb[CTRL_ATTR_MAX + 1];
+	struct nlattr * grp[CTRL_ATTR_MCAST_GRP_MAX + 1];
+	struct nlattr * g;
+	struct nlmsghdr * n;
+	char buf[BUF_SIZE];
+	int name_len = strlen(ELEVATOR_GENL_NAME) + 1;
+	int len;
+	int rem;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_type = GENL_ID_CTRL;
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.g.cmd = CTRL_CMD_GETFAMILY;
+	req.g.version = 1;
+
+	a = (struct nlattr *)req.attrs;
+	a->nla_type = CTRL_ATTR_FAMILY_NAME;
+	a->nla_len = NLA_HDRLEN + name_len;
+	memcpy(attr_data(a), ELEVATOR_GENL_NAME, name_len);
+
+	req.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(a->nla_len);
+
+	if (send(fd, &req, req.n.nlmsg_len, 0) < 0)
+		return -1;
+
+	len = recv(fd, buf, sizeof(buf), 0);
+	n = (struct nlmsghdr *)buf;
+
+	if (len < 0 || !NLMSG_OK(n, (unsigned int)len) ||
+	    n->nlmsg_type == NLMSG_ERROR)
+		return -1;
+
+	parse_attrs((struct nlattr *)((char *)NLMSG_DATA(n) + GENL_HDRLEN),
+		    n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), tb, CTRL_ATTR_MAX);
+
+	if (tb[CTRL_ATTR_FAMILY_ID] == NULL || tb[CTRL_ATTR_MCAST_GROUPS] == NULL)
+		return -1;
+
+	*family = *(uint16_t *)attr_data(tb[CTRL_ATTR_FAMILY_ID]);
+
+	// the groups are nested twice: a list of groups, each a list of
+	// name and id
+	g = attr_data(tb[CTRL_ATTR_MCAST_GROUPS]);
+	rem = tb[CTRL_ATTR_MCAST_GROUPS]->nla_len - NLA_HDRLEN;
+
+	while (rem >= (int)sizeof(*g) && g->nla_len >= sizeof(*g) &&
+	       g->nla_len <= rem)
+	{
+		parse_attrs(attr_data(g), g->nla_len - NLA_HDRLEN, grp,
+			    CTRL_ATTR_MCAST_GRP_MAX);
+
+		if (grp[CTRL_ATTR_MCAST_GRP_NAME] != NULL &&
+		    grp[CTRL_ATTR_MCAST_GRP_ID] != NULL &&
+		    strcmp(attr_data(grp[CTRL_ATTR_MCAST_GRP_NAME]),
+			   ELEVATOR_GENL_MCGRP) == 0)
+		{
+			*group = *(uint32_t *)attr_data(grp[CTRL_ATTR_MCAST_GRP_ID]);
+			return 0;
+		}
+
+		rem -= NLA_ALIGN(g->nla_len);
+		g = attr_next(g);
+	}
+
+	return -1;
+}
+
+
+/*************************************************************************/
+
+
+static unsigned int attr_u8(struct nlattr ** tb, int type)
+{
+	return tb[type] ? *(uint8_t *)attr_data(tb[type]) : 0;
+}
+
+
+/* print_event() prints one event; returns 1 if it was shown */
+static int print_event(struct nlmsghdr * n, int handle, uint64_t now)
+{
+	struct genlmsghdr * g = NLMSG_DATA(n);
+	struct nlattr * tb[ELEVATOR_A_MAX + 1];
+	uint64_t stamp;
+	unsigned int state;
+	int building;
+
+	if (g->cmd == 0 || g->cmd >= NUM_ELEVATOR_EVENTS)
+		return 0;
+
+	parse_attrs((struct nlattr *)((char *)g + GENL_HDRLEN),
+		    n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), tb, ELEVATOR_A_MAX);
+
+	if (tb[ELEVATOR_A_BUILDING] == NULL || tb[ELEVATOR_A_TIME_NS] == NULL)
+		return 0;
+
+	building = *(uint32_t *)attr_data(tb[ELEVATOR_A_BUILDING]);
+	if (handle >= 0 && building != handle)
+		return 0;
+
+	memcpy(&stamp, attr_data(tb[ELEVATOR_A_TIME_NS]), sizeof(stamp));
+	state = attr_u8(tb, ELEVATOR_A_STATE);
+
+	printf("%llu %d %-7s %-7s floor %2u", (unsigned long long)stamp,
+	       building, event_names[g->cmd],
+	       state < 5 ? state_names[state] : "?",
+	       attr_u8(tb, ELEVATOR_A_FLOOR));
+
+	if (tb[ELEVATOR_A_SRC] != NULL)
+		printf("  %2u -> %2u  units %u", attr_u8(tb, ELEVATOR_A_SRC),
+		       attr_u8(tb, ELEVATOR_A_DST), attr_u8(tb, ELEVATOR_A_UNITS));
+
+	if (tb[ELEVATOR_A_COUNT] != NULL &&
+	    *(uint32_t *)attr_data(tb[ELEVATOR_A_COUNT]) > 1)
+		printf("  x%u", *(uint32_t *)attr_data(tb[ELEVATOR_A_COUNT]));
+
+	// both clocks are CLOCK_MONOTONIC
+	printf("  (+%llu us)\n", now > stamp ?
+	       (unsigned long long)(now - stamp) / 1000 : 0ULL);
+
+	return 1;
+}
+
+
+static void usage(const char * prog)
+{
+	fprintf(stderr, "usage: %s [-b building] [-n count]\n", prog);
+	exit(1);
+}
+
+
+int main(int argc, char ** argv)
+{
+	struct sockaddr_nl addr;
+	struct nlmsghdr * n;
+	char buf[BUF_SIZE];
+	long count = -1;
+	long shown = 0;
+	int handle = -1;
+	int family;
+	int group;
+	int fd;
+	int len;
+	int c;
+
+	while ((c = getopt(argc, argv, "b:n:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'b':
+			{
+				if (select_building(optarg) != 0)
+				{
+					perror(stats_path);
+					return 1;
+				}
+
+				handle = building_handle;
+				break;
+			}
+
+			case 'n': count = atol(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if (fd < 0)
+	{
+		perror("socket");
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		perror("bind");
+		return 1;
+	}
+
+	if (resolve_family(fd, &family, &group) != 0)
+	{
+		fprintf(stderr, "no \"%s\" netlink family; is the module "
+			"loaded?\n", ELEVATOR_GENL_NAME);
+		return 1;
+	}
+
+	if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group,
+		       sizeof(group)) != 0)
+	{
+		perror("NETLINK_ADD_MEMBERSHIP");
+		return 1;
+	}
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	while (count < 0 || shown < count)
+	{
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0)
+		{
+			// the socket overflowed and events were lost
+			if (errno == ENOBUFS)
+			{
+				fprintf(stderr, "events dropped\n");
+				continue;
+			}
+
+			if (errno == EINTR)
+				continue;
+
+			perror("recv");
+			return 1;
+		}
+
+		for (n = (struct nlmsghdr *)buf; NLMSG_OK(n, (unsigned int)len);
+		     n = NLMSG_NEXT(n, len))
+		{
+			if (n->nlmsg_type == family)
+				shown += print_event(n, handle, now_ns());
+		}
+	}
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,395 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+/* Concurrency stress test and lock-contention profiler for the
+ * elevator module.
+ *
+ * Hundreds of threads call start_elevator(), issue_request() and
+ * stop_elevator() in a random mix while a monitor thread keeps
+ * checking the conservation invariant
+ *
+ *     issued = waiting + riding + delivered + dropped
+ *
+ * on snapshots of the building's stats file. At the end the elevator
+ * is stopped, the invariant is checked once more on the quiescent
+ * module, and the per-site lock wait/hold times accumulated in the
+ * building's locks file during the run are printed. Load the module
+ * with check_invariants=1 to also fail on the module's own per-stop
+ * checks (invariant_violations in the stats file).
+ *
+ * usage: elevator_stress.x [-t threads] [-d secs] [-m start:issue:stop]
+ *                          [-i check_ms] [-s seed] [-b building] [-P]
+ *
+ * Exits with status 1 if the invariant was ever violated.
+ */
+
+enum Ops { OP_START, OP_ISSUE, OP_STOP, NUM_OPS };
+
+static const char * op_names[NUM_OPS] = { "start", "issue", "stop" };
+
+struct options
+{
+	int threads;
+	int duration;
+	int weights[NUM_OPS];
+	int check_ms;
+	unsigned long long seed;
+	const char * building;
+};
+
+struct op_latency
+{
+	long calls;
+	long failed;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+struct worker
+{
+	pthread_t thread;
+	const struct options * opts;
+	uint64_t rng;
+	uint64_t deadline;
+	struct op_latency ops[NUM_OPS];
+};
+
+struct monitor
+{
+	pthread_t thread;
+	const struct options * opts;
+	volatile int done;
+	long checks;
+	long violations;
+};
+
+
+/*************************************************************************/
+
+
+/* check_invariant() returns 1 if the snapshot conserves passengers,
+ * printing the offending counters otherwise
+ */
+static int check_invariant(const struct elevator_stats * stats,
+			   const char * when)
+{
+	long long issued = stat_get(stats, "issued");
+	long long waiting = stat_get(stats, "waiting");
+	long long riding = stat_get(stats, "riding");
+	long long delivered = stat_get(stats, "delivered");
+	long long dropped = stat_get(stats, "dropped");
+	long long inside = stat_get(stats, "invariant_violations");
+
+	// the module's own checks, with check_invariants=1
+	if (inside > 0)
+	{
+		fprintf(stderr, "invariant violated (%s): the module counted %lld"
+			" violations\n", when, inside);
+		return 0;
+	}
+
+	if (issued == waiting + riding + delivered + dropped)
+		return 1;
+
+	fprintf(stderr, "invariant violated (%s): issued %lld != waiting %lld"
+		" + riding %lld + delivered %lld + dropped %lld\n", when, issued,
+		waiting, riding, delivered, dropped);
+	return 0;
+}
+
+
+static void * monitor_run(void * arg)
+{
+	struct monitor * m = arg;
+	struct elevator_stats stats;
+
+	while (!m->done)
+	{
+		if (read_stats(&stats) == 0)
+		{
+			m->checks++;
+			if (!check_invariant(&stats, "during run"))
+				m->violations++;
+		}
+
+		sleep_ns((uint64_t)m->opts->check_ms * 1000000ULL);
+	}
+
+	return NULL;
+}
+
+
+/*************************************************************************/
+
+
+static int pick_op(struct worker * w)
+{
+	const int * weights = w->opts->weights;
+	int total = weights[OP_START] + weights[OP_ISSUE] + weights[OP_STOP];
+	int r = rng_range(&w->rng, 0, total - 1);
+	int op;
+
+	for (op = 0; op < NUM_OPS - 1; op++)
+	{
+		if (r < weights[op])
+			break;
+		r -= weights[op];
+	}
+
+	return op;
+}
+
+
+static void * worker_run(void * arg)
+{
+	struct worker * w = arg;
+	struct op_latency * l;
+	uint64_t start;
+	uint64_t elapsed;
+	long ret = 0;
+	int op;
+
+	while (now_ns() < w->deadline)
+	{
+		op = pick_op(w);
+		start = now_ns();
+
+		switch (op)
+		{
+			case OP_START:
+				ret = start_elevator();
+				break;
+
+			case OP_ISSUE:
+				ret = issue_request(rng_range(&w->rng, 1, 4),
+						    rng_range(&w->rng, 1, NUM_FLOORS),
+						    rng_range(&w->rng, 1, NUM_FLOORS));
+				break;
+
+			case OP_STOP:
+				ret = stop_elevator();
+				break;
+		}
+
+		elapsed = now_ns() - start;
+
+		l = &w->ops[op];
+		l->calls++;
+		if (ret != 0)
+			l->failed++;
+		l->total_ns += elapsed;
+		if (elapsed > l->max_ns)
+			l->max_ns = elapsed;
+
+		// a little jitter keeps the threads from marching in step
+		sleep_ns(rng_range(&w->rng, 0, 1000000));
+	}
+
+	return NULL;
+}
+
+
+/*************************************************************************/
+
+
+static const struct lock_site * find_site(const struct lock_profile * p,
+					  const char * name)
+{
+	int i;
+
+	for (i = 0; i < p->count; i++)
+	{
+		if (strcmp(p->sites[i].name, name) == 0)
+			return &p->sites[i];
+	}
+
+	return NULL;
+}
+
+
+/* print_lock_profile() prints what each lock site accumulated between
+ * the two snapshots; maxima are since module insertion
+ */
+static void print_lock_profile(const struct lock_profile * before,
+			       const struct lock_profile * after)
+{
+	const struct lock_site * a;
+	const struct lock_site * b;
+	unsigned long long n;
+	int i;
+
+	printf("\n%-18s %10s %6s %12s %12s %12s %12s\n", "lock site",
+	       "acquired", "intr", "wait_avg_ns", "wait_max_ns", "hold_avg_ns",
+	       "hold_max_ns");
+
+	for (i = 0; i < after->count; i++)
+	{
+		a = &after->sites[i];
+		b = find_site(before, a->name);
+		n = a->acquired - (b ? b->acquired : 0);
+
+		if (n == 0)
+			continue;
+
+		printf("%-18s %10llu %6llu %12llu %12llu %12llu %12llu\n", a->name,
+		       n, a->interrupted - (b ? b->interrupted : 0),
+		       (a->wait_ns - (b ? b->wait_ns : 0)) / n, a->wait_max_ns,
+		       (a->hold_ns - (b ? b->hold_ns : 0)) / n, a->hold_max_ns);
+	}
+}
+
+
+static void usage(const char * prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads] [-d secs] [-m start:issue:stop]\n"
+		"          [-i check_ms] [-s seed] [-b building] [-P]\n"
+		"  -b  building under /proc/elevator to drive (default: %s)\n"
+		"  -P  drive the elevator through its status file\n", prog,
+		DEFAULT_BUILDING);
+	exit(1);
+}
+
+
+static void parse_options(int argc, char ** argv, struct options * opts)
+{
+	int c;
+
+	opts->threads = 200;
+	opts->duration = 30;
+	opts->weights[OP_START] = 2;
+	opts->weights[OP_ISSUE] = 96;
+	opts->weights[OP_STOP] = 2;
+	opts->check_ms = 50;
+	opts->seed = (unsigned long long)time(NULL);
+	opts->building = DEFAULT_BUILDING;
+
+	while ((c = getopt(argc, argv, "t:d:m:i:s:b:Ph")) != -1)
+	{
+		switch (c)
+		{
+			case 't': opts->threads = atoi(optarg); break;
+			case 'd': opts->duration = atoi(optarg); break;
+			case 'i': opts->check_ms = atoi(optarg); break;
+			case 's': opts->seed = strtoull(optarg, NULL, 0); break;
+			case 'b': opts->building = optarg; break;
+			case 'P': use_proc_ctl = 1; break;
+
+			case 'm':
+			{
+				if (sscanf(optarg, "%d:%d:%d", &opts->weights[OP_START],
+					   &opts->weights[OP_ISSUE],
+					   &opts->weights[OP_STOP]) != 3)
+					usage(argv[0]);
+				break;
+			}
+
+			default: usage(argv[0]);
+		}
+	}
+
+	if (opts->threads <= 0 || opts->duration <= 0 || opts->check_ms <= 0 ||
+	    opts->weights[OP_START] < 0 || opts->weights[OP_ISSUE] < 0 ||
+	    opts->weights[OP_STOP] < 0 ||
+	    opts->weights[OP_START] + opts->weights[OP_ISSUE] +
+	    opts->weights[OP_STOP] <= 0)
+		usage(argv[0]);
+}
+
+
+/*************************************************************************/
+
+
+int main(int argc, char ** argv)
+{
+	struct options opts;
+	struct worker * workers;
+	struct monitor monitor;
+	struct elevator_stats stats;
+	struct lock_profile before;
+	struct lock_profile after;
+	struct op_latency total;
+	uint64_t deadline;
+	int ok;
+	int op;
+	int i;
+
+	parse_options(argc, argv, &opts);
+
+	if (select_building(opts.building) != 0 ||
+	    read_lock_profile(&before) != 0)
+	{
+		perror(locks_path);
+		return 1;
+	}
+
+	workers = calloc(opts.threads, sizeof(*workers));
+	deadline = now_ns() + (uint64_t)opts.duration * 1000000000ULL;
+
+	memset(&monitor, 0, sizeof(monitor));
+	monitor.opts = &opts;
+	pthread_create(&monitor.thread, NULL, monitor_run, &monitor);
+
+	for (i = 0; i < opts.threads; i++)
+	{
+		workers[i].opts = &opts;
+		workers[i].rng = opts.seed * 2654435761ULL + i + 1;
+		workers[i].deadline = deadline;
+		pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+	}
+
+	for (i = 0; i < opts.threads; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	monitor.done = 1;
+	pthread_join(monitor.thread, NULL);
+
+	// quiesce the module so the final check sees a settled state
+	stop_elevator();
+
+	if (read_stats(&stats) != 0 || read_lock_profile(&after) != 0)
+	{
+		perror("reading /proc");
+		return 1;
+	}
+
+	ok = check_invariant(&stats, "after stop");
+
+	printf("%-6s %10s %8s %12s %12s\n", "call", "calls", "failed",
+	       "avg_ns", "max_ns");
+
+	for (op = 0; op < NUM_OPS; op++)
+	{
+		memset(&total, 0, sizeof(total));
+
+		for (i = 0; i < opts.threads; i++)
+		{
+			total.calls += workers[i].ops[op].calls;
+			total.failed += workers[i].ops[op].failed;
+			total.total_ns += workers[i].ops[op].total_ns;
+			if (workers[i].ops[op].max_ns > total.max_ns)
+				total.max_ns = workers[i].ops[op].max_ns;
+		}
+
+		printf("%-6s %10ld %8ld %12llu %12llu\n", op_names[op], total.calls,
+		       total.failed,
+		       total.calls ?
+				(unsigned long long)(total.total_ns / total.calls) : 0ULL,
+		       (unsigned long long)total.max_ns);
+	}
+
+	print_lock_profile(&before, &after);
+
+	printf("\n%ld invariant checks during the run, %ld violations; "
+	       "final check %s\n", monitor.checks, monitor.violations,
+	       ok ? "passed" : "FAILED");
+
+	free(workers);
+	return (ok && monitor.violations == 0) ? 0 : 1;
+}
@@ -0,0 +1,356 @@
+#include <getopt.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "../elevator/elevator_dispatch.h"
+
+/* Microbenchmark of the elevator module's passenger scans.
+ *
+ * Fills a building with waiting passengers twice, once the way the
+ * module used to hold them and once the way it does now, and times
+ * the two scans the service thread runs at every stop:
+ *
+ *     next   the nearest pickup above (find_next_floor_up())
+ *     board  who on the car's floor can get on (load_elev())
+ *
+ * "list" is one heap node per passenger on a single list in issue
+ * order, walked in full by both scans. "indexed" merges identical
+ * trips into one group node on a per-floor queue and keeps a trip
+ * table with a destination mask per floor, so "next" tests at most
+ * ten masks and "board" only walks the groups on the car's floor.
+ *
+ * Runs in userspace and needs no module; the group, trip table and
+ * next-stop scan are the module's own, from elevator_dispatch.h.
+ *
+ * usage: passenger_scan.x [-n passengers] [-i iterations] [-s seed]
+ *
+ * Prints the mean cost of each scan in ns, and per 10k waiting.
+ */
+
+#define NUM_TYPES 4
+
+struct building
+{
+	struct list_head list;
+	struct list_head floor_waiting[NUM_FLOORS];
+	struct trip_table trips;
+};
+
+/* keeps the compiler from dropping the scans */
+static volatile long sink;
+
+
+/*************************************************************************/
+
+
+static void node_init(struct list_head * head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+
+static void node_add_tail(struct list_head * n, struct list_head * head)
+{
+	n->prev = head->prev;
+	n->next = head;
+	head->prev->next = n;
+	head->prev = n;
+}
+
+
+#define entry_of(n, member) \
+	((Passenger *)((char *)(n) - offsetof(Passenger, member)))
+
+
+/*************************************************************************/
+
+
+/* fill_list() queues n passengers one node each, allocated in random
+ * order so that list neighbours are not heap neighbours, as happens
+ * when requests arrive from many callers over a long run
+ */
+static Passenger ** fill_list(struct building * b, int n,
+			       const int * src, const int * dst,
+			       const int * type, uint64_t * rng)
+{
+	Passenger ** nodes = malloc(sizeof(*nodes) * n);
+	Passenger * t;
+	int i;
+	int j;
+
+	node_init(&b->list);
+
+	for (i = 0; i < n; i++)
+		nodes[i] = calloc(1, sizeof(Passenger));
+
+	for (i = n - 1; i > 0; i--)
+	{
+		j = rng_next(rng) % (i + 1);
+		t = nodes[i];
+		nodes[i] = nodes[j];
+		nodes[j] = t;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		nodes[i]->src = src[i];
+		nodes[i]->dst = dst[i];
+		nodes[i]->p_type = type[i];
+		nodes[i]->count = 1;
+		node_add_tail(&nodes[i]->list, &b->list);
+	}
+
+	return nodes;
+}
+
+
+static int list_next_up(struct building * b, int cur)
+{
+	struct list_head * n;
+	Passenger * p;
+	int next = -1;
+	int closest = NUM_FLOORS + 1;
+
+	for (n = b->list.next; n != &b->list; n = n->next)
+	{
+		p = entry_of(n, list);
+
+		if (p->src > cur && p->src <= closest && p->dst > cur)
+		{
+			next = p->src;
+			closest = p->src;
+		}
+	}
+
+	return next;
+}
+
+
+static long list_board(struct building * b, int cur)
+{
+	struct list_head * n;
+	Passenger * p;
+	long boarding = 0;
+
+	for (n = b->list.next; n != &b->list; n = n->next)
+	{
+		p = entry_of(n, list);
+
+		if (p->src == cur)
+			boarding += p->count;
+	}
+
+	return boarding;
+}
+
+
+/*************************************************************************/
+
+
+/* fill_indexed() queues the same passengers as the module does now:
+ * identical trips share a group node on their floor's queue; returns
+ * the number of groups
+ */
+static int fill_indexed(struct building * b, int n, const int * src,
+			const int * dst, const int * type, Passenger ** groups)
+{
+	struct list_head * q;
+	Passenger * p;
+	int ngroups = 0;
+	int i;
+	int f;
+
+	memset(b, 0, sizeof(*b));
+	node_init(&b->list);
+
+	for (f = 0; f < NUM_FLOORS; f++)
+		node_init(&b->floor_waiting[f]);
+
+	for (i = 0; i < n; i++)
+	{
+		trip_count(&b->trips, src[i], dst[i], 1);
+
+		p = NULL;
+		for (q = b->floor_waiting[src[i] - 1].next;
+		     q != &b->floor_waiting[src[i] - 1]; q = q->next)
+		{
+			if (entry_of(q, floor)->dst == dst[i] &&
+			    entry_of(q, floor)->p_type == type[i])
+			{
+				p = entry_of(q, floor);
+				break;
+			}
+		}
+
+		if (p != NULL)
+		{
+			p->count++;
+			continue;
+		}
+
+		p = calloc(1, sizeof(*p));
+		p->src = src[i];
+		p->dst = dst[i];
+		p->p_type = type[i];
+		p->count = 1;
+		node_add_tail(&p->list, &b->list);
+		node_add_tail(&p->floor, &b->floor_waiting[src[i] - 1]);
+		groups[ngroups++] = p;
+	}
+
+	return ngroups;
+}
+
+
+static int indexed_next_up(struct building * b, int cur)
+{
+	return nearest_call_up(&b->trips, cur, NUM_FLOORS);
+}
+
+
+static long indexed_board(struct building * b, int cur)
+{
+	struct list_head * n;
+	long boarding = 0;
+
+	for (n = b->floor_waiting[cur - 1].next;
+	     n != &b->floor_waiting[cur - 1]; n = n->next)
+		boarding += entry_of(n, floor)->count;
+
+	return boarding;
+}
+
+
+/*************************************************************************/
+
+
+/* time_scan() returns the mean ns of one scan over iters calls, each
+ * from a different floor
+ */
+static double time_scan(long (*scan)(struct building *, int),
+			struct building * b, long iters)
+{
+	uint64_t start;
+	long sum = 0;
+	long i;
+
+	start = now_ns();
+
+	for (i = 0; i < iters; i++)
+		sum += scan(b, 1 + i % NUM_FLOORS);
+
+	sink = sum;
+	return (double)(now_ns() - start) / iters;
+}
+
+
+static long list_next_scan(struct building * b, int cur)
+{
+	return list_next_up(b, cur);
+}
+
+
+static long indexed_next_scan(struct building * b, int cur)
+{
+	return indexed_next_up(b, cur);
+}
+
+
+static void usage(const char * prog)
+{
+	fprintf(stderr, "usage: %s [-n passengers] [-i iterations] "
+		"[-s seed]\n", prog);
+	exit(1);
+}
+
+
+int main(int argc, char ** argv)
+{
+	struct building list_b;
+	struct building indexed_b;
+	Passenger ** nodes;
+	Passenger ** groups;
+	uint64_t rng = 0x9e3779b97f4a7c15ULL;
+	double per10k;
+	double t[2][2];
+	long iters = 20000;
+	int * src;
+	int * dst;
+	int * type;
+	int ngroups;
+	int n = 10000;
+	int i;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:i:s:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'n': n = atoi(optarg); break;
+			case 'i': iters = atol(optarg); break;
+			case 's': rng = strtoull(optarg, NULL, 0) | 1; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (n <= 0 || iters <= 0)
+		usage(argv[0]);
+
+	src = malloc(sizeof(int) * n);
+	dst = malloc(sizeof(int) * n);
+	type = malloc(sizeof(int) * n);
+	groups = malloc(sizeof(*groups) * n);
+
+	for (i = 0; i < n; i++)
+	{
+		src[i] = 1 + rng_next(&rng) % NUM_FLOORS;
+		dst[i] = 1 + rng_next(&rng) % NUM_FLOORS;
+		type[i] = 1 + rng_next(&rng) % NUM_TYPES;
+	}
+
+	nodes = fill_list(&list_b, n, src, dst, type, &rng);
+	ngroups = fill_indexed(&indexed_b, n, src, dst, type, groups);
+
+	// both layouts must agree before their times mean anything
+	for (i = 1; i <= NUM_FLOORS; i++)
+	{
+		if (list_next_up(&list_b, i) != indexed_next_up(&indexed_b, i) ||
+		    list_board(&list_b, i) != indexed_board(&indexed_b, i))
+		{
+			fprintf(stderr, "layouts disagree on floor %d\n", i);
+			return 1;
+		}
+	}
+
+	t[0][0] = time_scan(list_next_scan, &list_b, iters);
+	t[0][1] = time_scan(list_board, &list_b, iters);
+	t[1][0] = time_scan(indexed_next_scan, &indexed_b, iters);
+	t[1][1] = time_scan(indexed_board, &indexed_b, iters);
+
+	printf("%d waiting, %d groups, %ld scans each\n", n, ngroups, iters);
+	printf("%-8s %12s %12s %14s %14s\n", "layout", "next_ns", "board_ns",
+	       "next_ns/10k", "board_ns/10k");
+
+	per10k = 10000.0 / n;
+	printf("%-8s %12.1f %12.1f %14.1f %14.1f\n", "list", t[0][0], t[0][1],
+	       t[0][0] * per10k, t[0][1] * per10k);
+	printf("%-8s %12.1f %12.1f %14.1f %14.1f\n", "indexed", t[1][0],
+	       t[1][1], t[1][0] * per10k, t[1][1] * per10k);
+
+	for (i = 0; i < n; i++)
+		free(nodes[i]);
+
+	for (i = 0; i < ngroups; i++)
+		free(groups[i]);
+
+	free(nodes);
+	free(groups);
+	free(src);
+	free(dst);
+	free(type);
+
+	return 0;
+}
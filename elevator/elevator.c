@@ -1,998 +1,3092 @@
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/cpumask.h>
+#include <linux/ctype.h>
 #include <linux/delay.h>
 #include <linux/errno.h>
 #include <linux/fcntl.h>
+#include <linux/idr.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/kref.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
 #include <linux/linkage.h>
+#include <linux/math64.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/proc_fs.h>
 #include <linux/random.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
+#include <linux/sched/types.h>
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+#include <net/genetlink.h>
+
+#include "elevator_dispatch.h"
+#include "elevator_netlink.h"
+
+#ifdef ELEVATOR_SYSCALLS
+#include "elevator_ops.h"
+#endif
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Simulates elevator");
 
+/* /proc entries are registered with a struct proc_ops from 5.6 on */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+typedef struct proc_ops proc_fops_t;
+#define SET_PROC_FOPS(f, o, r, w, rel) \
+	do { \
+		(f).proc_open = (o); \
+		(f).proc_read = (r); \
+		(f).proc_write = (w); \
+		(f).proc_release = (rel); \
+	} while (0)
+#else
+typedef struct file_operations proc_fops_t;
+#define SET_PROC_FOPS(f, o, r, w, rel) \
+	do { \
+		(f).open = (o); \
+		(f).read = (r); \
+		(f).write = (w); \
+		(f).release = (rel); \
+	} while (0)
+#endif
+
+/* the data pointer handed to proc_create_data() */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+#define PROC_DATA(inode) pde_data(inode)
+#else
+#define PROC_DATA(inode) PDE_DATA(inode)
+#endif
+
+/* every building gets a /proc/elevator/<name> directory holding the
+ * status, stats, locks, eta, floors and jitter files;
+ * /proc/elevator/buildings lists the buildings and creates and
+ * destroys them
+ */
 #define ENTRY_NAME "elevator"
-#define ENTRY_SIZE 700
 #define PERMS 0644
 #define PARENT NULL
-static struct file_operations fops;
+static struct proc_dir_entry * elevator_dir;
+
+#define BUILDINGS_ENTRY_NAME "buildings"
+#define BUILDINGS_ENTRY_SIZE 4096
+static proc_fops_t buildings_fops;
+
+#define STATUS_ENTRY_NAME "status"
+#define STATUS_ENTRY_SIZE 1024
+static proc_fops_t fops;
+
+/* writes to a status file larger than this are refused */
+#define CTL_MAX_WRITE (64 * 1024)
+
+#define STATS_ENTRY_NAME "stats"
+#define STATS_ENTRY_SIZE 4096
+static proc_fops_t stats_fops;
+
+#define LOCKS_ENTRY_NAME "locks"
+#define LOCKS_ENTRY_SIZE 4096
+static proc_fops_t locks_fops;
+
+#define ETA_ENTRY_NAME "eta"
+#define ETA_ENTRY_SIZE 512
+static proc_fops_t eta_fops;
+
+#define FLOORS_ENTRY_NAME "floors"
+#define FLOORS_ENTRY_SIZE 1024
+static proc_fops_t floors_fops;
+
+#define JITTER_ENTRY_NAME "jitter"
+#define JITTER_ENTRY_SIZE 1024
+static proc_fops_t jitter_fops;
+
+/* building names are also directory names under /proc/elevator */
+#define BUILDING_NAME_LEN 32
+
+/* the building created when the module is inserted; its handle is 0 */
+#define DEFAULT_BUILDING "default"
+
+static int default_cpu = -1;
+module_param(default_cpu, int, 0444);
+MODULE_PARM_DESC(default_cpu,
+		 "CPU the default building's service thread runs on (-1: any)");
+
+/* a building's service thread runs under one of these scheduling
+ * policies, chosen when it is created; default_policy is the default
+ * building's. A deadline thread gets deadline_runtime_us of CPU every
+ * deadline_period_us, and cannot be pinned to a CPU
+ */
+enum Service_Policies { POLICY_NORMAL, POLICY_FIFO, POLICY_DEADLINE,
+			NUM_POLICIES };
 
-static char * message;  
-static int read_p;
+static const char * policy_names[NUM_POLICIES] =
+{
+	"normal", "fifo", "deadline"
+};
+
+static char * default_policy = "normal";
+module_param(default_policy, charp, 0444);
+MODULE_PARM_DESC(default_policy,
+		 "Scheduling policy of the default building's service thread "
+		 "(normal, fifo or deadline)");
+
+static unsigned int deadline_runtime_us = 2000;
+module_param(deadline_runtime_us, uint, 0444);
+MODULE_PARM_DESC(deadline_runtime_us,
+		 "CPU time per period of a deadline service thread (us)");
+
+static unsigned int deadline_period_us = 10000;
+module_param(deadline_period_us, uint, 0444);
+MODULE_PARM_DESC(deadline_period_us,
+		 "Period (and deadline) of a deadline service thread (us)");
 
 enum States { OFFLINE, IDLE, LOADING, UP, DOWN };
+#define NUM_STATES (DOWN + 1)
+
+static const char * state_names[NUM_STATES] =
+{
+	"OFFLINE", "IDLE", "LOADING", "UP", "DOWN"
+};
+
+/* wait and ride times are binned into STATS_HIST_BUCKETS buckets of
+ * STATS_HIST_WIDTH_MS each; the last bucket collects everything longer
+ */
+#define STATS_HIST_BUCKETS 240
+#define STATS_HIST_WIDTH_MS 500
+
+/* door dwell at a stop scales with the passengers who board or alight
+ * there, clamped to [dwell_min_ms, dwell_max_ms]; a stop where nobody
+ * moves only costs dwell_min_ms. All four are writable through
+ * /sys/module/elevator/parameters
+ */
+static unsigned int dwell_min_ms = 0;
+module_param(dwell_min_ms, uint, 0644);
+MODULE_PARM_DESC(dwell_min_ms, "Shortest door dwell at a stop (ms)");
+
+static unsigned int dwell_max_ms = 3000;
+module_param(dwell_max_ms, uint, 0644);
+MODULE_PARM_DESC(dwell_max_ms, "Longest door dwell at a stop (ms)");
+
+static unsigned int dwell_base_ms = 500;
+module_param(dwell_base_ms, uint, 0644);
+MODULE_PARM_DESC(dwell_base_ms, "Door open/close time when anyone moves (ms)");
+
+static unsigned int dwell_per_passenger_ms = 100;
+module_param(dwell_per_passenger_ms, uint, 0644);
+MODULE_PARM_DESC(dwell_per_passenger_ms,
+		 "Extra dwell per boarding or alighting passenger (ms)");
+
+/* the door dwell is timed with an hrtimer, allowed to run this much
+ * long so the wakeup can be merged with others
+ */
+#define DWELL_SLACK_US 50
+
+/* the fixed dwell every stop used to cost; time saved is measured
+ * against it
+ */
+#define LEGACY_DWELL_MS 1000
+
+/* a run between floors accelerates for travel_accel_ms, cruises at one
+ * floor per travel_floor_ms and brakes for travel_accel_ms
+ */
+static unsigned int travel_floor_ms = 2000;
+module_param(travel_floor_ms, uint, 0644);
+MODULE_PARM_DESC(travel_floor_ms, "Time per floor at cruise speed (ms)");
+
+static unsigned int travel_accel_ms = 1000;
+module_param(travel_accel_ms, uint, 0644);
+MODULE_PARM_DESC(travel_accel_ms,
+		 "Time to reach cruise speed from rest, and to brake (ms)");
+
+/* once the longest-waiting passenger has waited max_wait_ms, the car
+ * heads for their floor next, whatever else is pending; 0 lets the
+ * nearest stop always win
+ */
+static unsigned int max_wait_ms = 60000;
+module_param(max_wait_ms, uint, 0644);
+MODULE_PARM_DESC(max_wait_ms,
+		 "Wait after which a floor is served next (ms, 0: no bound)");
+
+/* the energy estimate charges every start (accelerating from rest),
+ * every floor moved, empty or with someone aboard, and every door
+ * cycle; the stats file prices the whole run with the values current
+ * when it is read, so policies can be compared under any cost model
+ */
+static unsigned int energy_start_mj = 20000;
+module_param(energy_start_mj, uint, 0644);
+MODULE_PARM_DESC(energy_start_mj, "Energy per start (mJ)");
+
+static unsigned int energy_floor_empty_mj = 8000;
+module_param(energy_floor_empty_mj, uint, 0644);
+MODULE_PARM_DESC(energy_floor_empty_mj, "Energy per floor moved empty (mJ)");
+
+static unsigned int energy_floor_loaded_mj = 12000;
+module_param(energy_floor_loaded_mj, uint, 0644);
+MODULE_PARM_DESC(energy_floor_loaded_mj,
+		 "Energy per floor moved with passengers aboard (mJ)");
+
+static unsigned int energy_door_mj = 2000;
+module_param(energy_door_mj, uint, 0644);
+MODULE_PARM_DESC(energy_door_mj, "Energy per door open/close cycle (mJ)");
+
+/* with check_invariants set, the service thread checks the dispatch
+ * core after every stop: the car's load against its riders, the
+ * per-floor queues against the trip table, that every passenger is
+ * accounted for exactly once, and that the stop walked no more groups
+ * than STOP_WALK_BOUND. Failures are counted in invariant_violations
+ * in the stats file and logged
+ */
+static bool check_invariants;
+module_param(check_invariants, bool, 0644);
+MODULE_PARM_DESC(check_invariants,
+		 "Check the dispatch invariants after every stop");
+
+/* every place that takes the elevator mutex is a lock site; wait and
+ * hold times are profiled per site and shown in the building's locks
+ * file
+ */
+enum Lock_Sites
+{
+	LOCK_START,
+	LOCK_LOAD,
+	LOCK_UNLOAD,
+	LOCK_ISSUE,
+	LOCK_STOP,
+	LOCK_SERVICE_PURGE,
+	LOCK_SERVICE_SCAN,
+	LOCK_SERVICE_IDLE,
+	LOCK_SERVICE_SEED,
+	LOCK_SERVICE_DIRECTION,
+	LOCK_SERVICE_DEPART,
+	LOCK_SERVICE_REPLAN,
+	LOCK_SERVICE_ARRIVE,
+	LOCK_PROC_STATS,
+	LOCK_PROC_LOCKS,
+	LOCK_PROC_CTL,
+	LOCK_ETA,
+	LOCK_PROC_ETA,
+	LOCK_PROC_FLOORS,
+	LOCK_PROC_STATUS,
+	LOCK_PROC_JITTER,
+	LOCK_SERVICE_CHECK,
+	NUM_LOCK_SITES
+};
+
+static const char * lock_site_names[NUM_LOCK_SITES] =
+{
+	"start", "load", "unload", "issue", "stop", "service_purge",
+	"service_scan", "service_idle", "service_seed", "service_direction",
+	"service_depart", "service_replan", "service_arrive", "proc_stats",
+	"proc_locks", "proc_ctl", "eta", "proc_eta", "proc_floors",
+	"proc_status", "proc_jitter", "service_check"
+};
+
+/* timed wakeups of the service thread (the end of a door dwell or of
+ * a run) are binned by how late they came: bucket 0 holds those under
+ * 1 us late, bucket i those 2^(i-1) to 2^i us late, and the last one
+ * everything later
+ */
+#define JITTER_BUCKETS 24
 
-#define MAX_PASSENGER_UNITS 10
-#define MAX_WEIGHT_INT 15
-#define MAX_WEIGHT_DEC 0
+/* event counters of a building, one copy per CPU: they are bumped
+ * with elev_count() on whichever CPU the event happens, with or
+ * without the mutex, and summed by counters_read(). Every field is
+ * 64 bits wide so the sum can walk them as an array
+ */
+struct elev_counters
+{
+	u64 issued;
+	u64 rejected;
+	u64 boarded;
+	u64 delivered;
+	u64 dropped;
+	u64 stops;
+	u64 dwell_ns;
+	s64 dwell_saved_ns;
+	u64 runs;
+	u64 replans;
+	u64 run_ns;
+	u64 floors_moved;
+	u64 floors_loaded;	// of floors_moved, with someone aboard
+	u64 starts;		// runs that left the floor
+	u64 door_cycles;
+	u64 state_ns[NUM_STATES];
+	u64 events;
+	u64 events_dropped;
+	u64 starved_runs;
+	u64 delivered_from[10];	// by the floor they were picked up on
+	u64 jitter_ns;
+	u64 jitter_hist[JITTER_BUCKETS];
+	u64 invariant_violations;
+};
 
+#define elev_count(parm, field, n) this_cpu_add((parm)->Counters->field, (n))
 
+/* one simulated building: a car, its passengers and the service
+ * thread that runs it. Buildings are looked up by handle under RCU
+ * and stay allocated while anyone holds a reference
+ */
 struct thread_parameter
 {
 	enum States Current_State;
 	int Current_Floor;
 	int Next_Floor;
 	int Waiting_Passengers[10];
-	int Total_Passengers[10];
 	
+	struct car_load Current_Load;
+
+	struct elev_counters __percpu * Counters;
+
+	// counters_read() reports the counts since the last start
+	struct elev_counters Counters_Base;
+	u64 State_Since;
+
+	struct
+	{
+		u64 wait_ns;
+		u64 ride_ns;
+		u64 busy_ns;
+		u64 load_ns;
+		u64 online_since;
+		u64 last_load_change;
+		u32 wait_hist[STATS_HIST_BUCKETS];
+		u32 ride_hist[STATS_HIST_BUCKETS];
+		u64 floor_served[10];
+		u64 floor_wait_ns[10];
+		u64 floor_wait_max_ns[10];
+	} Stats;
+
+	// per-site lock profile; everything but interrupted is only
+	// touched while holding the mutex
 	struct
 	{
-		int pass_units;
-		int weight_int;
-		int weight_dec;
-	} Current_Load;
+		u64 acquired;
+		u64 wait_ns;
+		u64 wait_max_ns;
+		u64 hold_ns;
+		u64 hold_max_ns;
+		atomic64_t interrupted;
+	} Lock_Sites[NUM_LOCK_SITES];
+	u64 Lock_Taken_At;
+
+	// woken when the state leaves IDLE, when the car goes OFFLINE
+	// (for stop_elevator) or a stop is added ahead of a moving car
+	// (Run_Replan)
+	wait_queue_head_t Run_Wait;
+	bool Run_Replan;
+
+	// the run under way: direction (1 up, -1 down, 0 none yet) and
+	// start time, 0 while the car is not moving
+	int Direction;
+	u64 Run_Started;
+
+	// pending stops, kept up to date as passengers come and go:
+	// riders by destination, and waiting passengers by floor and
+	// direction (ETA_UP, ETA_DOWN)
+	int Riders_To[10];
+	int Calls[2][10];
+
+	// ms from Eta_At until the car can pick up a new call on each
+	// floor in each direction, rebuilt by eta_refresh()
+	u32 Eta[2][10];
+	u64 Eta_At;
+
+	struct list_head list;	// passengers waiting on a floor
+	struct list_head elev;	// passengers riding the car
+
+	// the same waiting groups, by the floor they wait on, so boarding
+	// only looks at the car's floor; both lists are in issue order
+	struct list_head Floor_Waiting[10];
+
+	// the same waiting passengers by trip, which the next-stop scans
+	// read instead of walking the lists
+	struct trip_table Trips;
+	// groups unload/load_elev() walked at this stop; only the
+	// service thread touches it
+	int Stop_Walked;
+
+	bool stop;		// stop_elevator() was called
+	bool Removed;		// the building is being destroyed
+
+	char Name[BUILDING_NAME_LEN];
+	int Cpu;		// CPU kthread is bound to, or -1
+	int Policy;		// enum Service_Policies of kthread
+	struct proc_dir_entry * Proc_Dir;
+	struct kref Ref;
+	struct rcu_head Rcu;
 
-	struct list_head list;
 	int id;
 	struct task_struct * kthread;
 	struct mutex mutex;
 };
 
-typedef struct
-{
-	int src;
-	int dst;
-	int pass_units;
-	int weight_int;
-	int weight_dec;
-	struct list_head list;
-} Passenger;
+void eta_refresh(struct thread_parameter * parm);
 
-struct thread_parameter elevator;
-struct list_head list;
-struct list_head elev;
-bool stop;
+/* handle -> building; lookups run under RCU, changes hold
+ * buildings_mutex
+ */
+static DEFINE_IDR(buildings);
+static DEFINE_MUTEX(buildings_mutex);
 
 
 /*************************************************************************/
 
 
-/* my_start_elevator() sets the elevator's state to IDLE, as it
- * is no longer OFFLINE, and puts the elevator at floor 1, with
- * zero passengers on it or waiting on any floor
- */ 
-extern int (*STUB_start_elevator)(void);
-int my_start_elevator(void)
+/* elev_lock() takes the elevator mutex on behalf of a lock site,
+ * recording how long the caller waited for it; returns 0 once the
+ * mutex is held, or the error from mutex_lock_interruptible()
+ */
+int elev_lock(struct thread_parameter * parm, int site)
 {
-	// start_elevator implementation
-	
-	int i;
+	u64 start = ktime_get_ns();
+	u64 wait;
+	int ret;
 
-	if (elevator.Current_State != OFFLINE)
-		return 1;
-	else
+	ret = mutex_lock_interruptible(&parm->mutex);
+	if (ret != 0)
 	{
-//	 	try to initialize elevator:
+		atomic64_inc(&parm->Lock_Sites[site].interrupted);
+		return ret;
+	}
 
-		if (mutex_lock_interruptible(&elevator.mutex) == 0)
-		{
-			elevator.Current_Floor = 1;
-			elevator.Next_Floor = 1;
-			elevator.Current_Load.pass_units = 0;
-			elevator.Current_Load.weight_int = 0;
-			elevator.Current_Load.weight_dec = 0;
-			elevator.Current_State = IDLE;
-								
-			for (i = 0; i < 10; i++)
-			{
-				elevator.Waiting_Passengers[i] = 0;
-				elevator.Total_Passengers[i] = 0;
-			}
-		}
-		mutex_unlock(&elevator.mutex);
+	parm->Lock_Taken_At = ktime_get_ns();
+	wait = parm->Lock_Taken_At - start;
+
+	parm->Lock_Sites[site].acquired++;
+	parm->Lock_Sites[site].wait_ns += wait;
+	if (wait > parm->Lock_Sites[site].wait_max_ns)
+		parm->Lock_Sites[site].wait_max_ns = wait;
 
-	   	if (elevator.Current_State != IDLE)
-			return -1;
-	}
-	
 	return 0;
 }
 
 
+/* elev_unlock() releases the mutex taken by elev_lock(), charging
+ * the hold time to the same lock site
+ */
+void elev_unlock(struct thread_parameter * parm, int site)
+{
+	u64 hold = ktime_get_ns() - parm->Lock_Taken_At;
+
+	parm->Lock_Sites[site].hold_ns += hold;
+	if (hold > parm->Lock_Sites[site].hold_max_ns)
+		parm->Lock_Sites[site].hold_max_ns = hold;
+
+	mutex_unlock(&parm->mutex);
+}
+
+
 /*************************************************************************/
 
 
-/* load_elev() loads all qualifying passengers onto elevator
- * (must be on the same floor as the elevator and be able to fit)
+/* building_release() frees a building once the last reference to it
+ * is dropped; by then its service thread and /proc directory are gone
  */
-int load_elev(Passenger * p)
+void building_release(struct kref * ref)
 {
+	struct thread_parameter * parm =
+		container_of(ref, struct thread_parameter, Ref);
 	struct list_head * temp;
 	struct list_head * dummy;
-	bool can_get_on = true;
-	bool remove = false;
 
-	if (mutex_lock_interruptible(&elevator.mutex) == 0)
+	list_for_each_safe(temp, dummy, &parm->list)
 	{
-		list_for_each_safe(temp, dummy, &list)
-		{
-			p = list_entry(temp, Passenger, list);
-
-			if (p->src != elevator.Current_Floor)
-				can_get_on = false;
-	
-			if ((elevator.Current_Load.pass_units + p->pass_units) >
-				MAX_PASSENGER_UNITS)
-				can_get_on = false;
-
-			if ((elevator.Current_Load.weight_int + p->weight_int) >
-				MAX_WEIGHT_INT)
-				can_get_on = false;
-
-			if ((elevator.Current_Load.weight_int + p->weight_int) ==
-				MAX_WEIGHT_INT &&
-				(elevator.Current_Load.weight_dec == 5 ||
-				p->weight_dec == 5))
-				can_get_on = false;
-		
-			if (p->dst == elevator.Current_Floor)
-				remove = true;
-		}
+		list_del(temp);
+		kfree(list_entry(temp, Passenger, list));
 	}
-	mutex_unlock(&elevator.mutex);
 
-	if (mutex_lock_interruptible(&elevator.mutex) == 0)
+	list_for_each_safe(temp, dummy, &parm->elev)
 	{
-		if (can_get_on && !remove)
-		{
-			if (elevator.Current_Load.pass_units == 0)
-				INIT_LIST_HEAD(&elev);
-
-			elevator.Current_Load.pass_units += p->pass_units;
-
-			elevator.Current_Load.weight_int += p->weight_int;
-
-			if (elevator.Current_Load.weight_dec == 5 &&
-				p->weight_dec == 5)
-			{
-				elevator.Current_Load.weight_int++;
-				elevator.Current_Load.weight_dec = 0;
-			}
-			else
-			{
-				elevator.Current_Load.weight_dec += p->weight_dec;
-			}
-
-			elevator.Waiting_Passengers[elevator.Current_Floor - 1]--;
-			
-			list_move_tail(temp, &elev);
-		}
-		else if (remove)
-		{
-			elevator.Waiting_Passengers[elevator.Current_Floor - 1]--;
-			list_del(temp);
-			kfree(p);
-		}
+		list_del(temp);
+		kfree(list_entry(temp, Passenger, list));
 	}
-	mutex_unlock(&elevator.mutex);
 
-	return 0;
+	mutex_destroy(&parm->mutex);
+	free_percpu(parm->Counters);
+
+	// a lookup may still be looking at it under rcu_read_lock()
+	kfree_rcu(parm, Rcu);
 }
 
 
-/* unload_elev() removes a passenger from the elevator as long
- * they are on their destination floor (removing them from elev)
- */ 
-int unload_elev(Passenger * p)
+/* building_get() returns the building with the given handle with a
+ * reference held, or NULL if there is none; pair with building_put()
+ */
+struct thread_parameter * building_get(int building)
 {
-	// declare some temporary pointers
-	struct list_head * temp;
-	struct list_head * dummy;
+	struct thread_parameter * parm;
 
-	// use this since you need to change the pointers
-	if (mutex_lock_interruptible(&elevator.mutex) == 0)
-	{
-		list_for_each_safe(temp, dummy, &elev)
-		{
-			p = list_entry(temp, Passenger, list);
-	
-			if (p->dst == elevator.Current_Floor)
-			{
-				elevator.Current_Load.pass_units -= p->pass_units;
+	rcu_read_lock();
+	parm = idr_find(&buildings, building);
+	if (parm != NULL && !kref_get_unless_zero(&parm->Ref))
+		parm = NULL;
+	rcu_read_unlock();
 
-				elevator.Current_Load.weight_int -= p->weight_int;
+	return parm;
+}
 
-				if (elevator.Current_Load.weight_dec == 0 &&
-					p->weight_dec == 5)
-				{
-					elevator.Current_Load.weight_int--;
-					elevator.Current_Load.weight_dec = 5;
-				}
-				else
-				{
-					elevator.Current_Load.weight_dec -=
-					p->weight_dec;
-				}
-	
-				elevator.Total_Passengers[p->src - 1]++;
-	
-				list_del(temp);	// init ver also reinits list
-				kfree(p);		// remember to free allocated data
-			}
-		}
-	}
-	mutex_unlock(&elevator.mutex);
 
-	return 0;
+void building_put(struct thread_parameter * parm)
+{
+	kref_put(&parm->Ref, building_release);
 }
 
 
 /*************************************************************************/
 
 
-/* this function will be called when needing to find the next
- * closest floor to go to that is up. returns -1 if there
- * is none, otherwise it will return the floor number as an int */
-int find_next_floor_up(int current_floor)
+/* events are multicast on a generic netlink family, so listeners get
+ * them pushed instead of polling the status file
+ */
+static const struct genl_multicast_group elev_mcgrps[] =
+{
+	{ .name = ELEVATOR_GENL_MCGRP },
+};
+
+static struct genl_family elev_genl_family =
 {
-	struct list_head * temp;
-    Passenger * p;
-
-    int next_floor = -1;
-    int closest_floor = 11; //set this initially 
-
-	if (elevator.Current_Load.pass_units > 0)
-	{
-		list_for_each(temp, &elev)
-   	 	{
-    		p = list_entry(temp, Passenger, list);
-				
-			// for each passenger, if their dest is greater
-			// than current floor
-			// (i.e. they're going up), and if their dest is less
-			// than the current closest_floor
-			if (p->dst > current_floor && p->dst < closest_floor)
-			{
-				//make this our next_floor
-				next_floor = p->dst;
-				//update closest_floor to this particular passenger's 
-				closest_floor = p->dst;
-			}
-		}	
-	
-		list_for_each(temp, &list)
-	   	{
-    	  	p = list_entry(temp, Passenger, list);
-   
-		    if (p->src > current_floor && p->src <= closest_floor &&
-				p->dst > current_floor)
-    	    {
-        		next_floor = p->src;
- 	          	closest_floor = p->src;
- 			}   	
-		}
-	}
+	.name = ELEVATOR_GENL_NAME,
+	.version = ELEVATOR_GENL_VERSION,
+	.maxattr = ELEVATOR_A_MAX,
+	.module = THIS_MODULE,
+	.mcgrps = elev_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(elev_mcgrps),
+};
 
-	return next_floor;
-}
+/* the largest event: building, time, state, floor and a group */
+#define ELEVATOR_EVENT_SIZE (2 * nla_total_size(sizeof(u32)) + \
+	nla_total_size_64bit(sizeof(u64)) + 5 * nla_total_size(sizeof(u8)))
 
 
-/* function for determining next floor going down.
- * operates the exact same way as find_next_floor_up
- * returns -1 if no passenger needs to go down
+/* elev_event() multicasts one event about the building, with the
+ * passenger it concerns (or NULL); it costs one check while nobody
+ * is listening. Must be called with the mutex held
  */
-int find_next_floor_down(int current_floor)
+void elev_event(struct thread_parameter * parm, int cmd, Passenger * p)
 {
-	struct list_head * temp;
-    Passenger * p;
+	struct sk_buff * skb;
+	void * hdr;
 
-    int next_floor = -1;
-    int closest_floor = 0;
+	if (!genl_has_listeners(&elev_genl_family, &init_net, 0))
+		return;
 
-	if (elevator.Current_Load.pass_units > 0)
-	{	
-	    list_for_each(temp, &elev)
-		{
-    		p = list_entry(temp, Passenger, list);
-    	
-			if (p->dst < current_floor && p->dst > closest_floor)
-    		{
-        		next_floor = p->dst;
-            	closest_floor = p->dst;
- 		   	}
-		}
+	elev_count(parm, events, 1);
 
-		list_for_each(temp, &list)
-	   	{
-      		p = list_entry(temp, Passenger, list);
-    
-			if (p->src < current_floor && p->src >= closest_floor &&
-				p->dst < current_floor)
-    		{
-        		next_floor = p->src;
-            	closest_floor = p->src;
- 		   	}	
-		}
-	}
+	skb = genlmsg_new(ELEVATOR_EVENT_SIZE, GFP_KERNEL);
+	if (skb == NULL)
+		goto dropped;
 
-	return next_floor;
-}
+	hdr = genlmsg_put(skb, 0, 0, &elev_genl_family, 0, cmd);
+	if (hdr == NULL)
+		goto failed;
 
+	if (nla_put_u32(skb, ELEVATOR_A_BUILDING, parm->id) ||
+		nla_put_u64_64bit(skb, ELEVATOR_A_TIME_NS, ktime_get_ns(),
+				  ELEVATOR_A_PAD) ||
+		nla_put_u8(skb, ELEVATOR_A_STATE, parm->Current_State) ||
+		nla_put_u8(skb, ELEVATOR_A_FLOOR, parm->Current_Floor))
+		goto failed;
 
-/*************************************************************************/
+	if (p != NULL &&
+		(nla_put_u8(skb, ELEVATOR_A_SRC, p->src) ||
+		 nla_put_u8(skb, ELEVATOR_A_DST, p->dst) ||
+		 nla_put_u8(skb, ELEVATOR_A_UNITS, p->pass_units) ||
+		 nla_put_u32(skb, ELEVATOR_A_COUNT, p->count)))
+		goto failed;
+
+	genlmsg_end(skb, hdr);
+
+	// a listener whose socket buffer is full misses the event
+	if (genlmsg_multicast(&elev_genl_family, skb, 0, 0, GFP_KERNEL) ==
+		-ENOBUFS)
+		elev_count(parm, events_dropped, 1);
 
+	return;
 
-extern int (*STUB_issue_request)(int, int, int);
-int my_issue_request(int p_type, int start_floor, int dest_floor)
+failed:
+	nlmsg_free(skb);
+dropped:
+	elev_count(parm, events_dropped, 1);
+}
+
+
+/* set_state() moves the car to a new state and tells listeners if
+ * that is a change; must be called with the mutex held
+ */
+void set_state(struct thread_parameter * parm, enum States state)
 {
-	// issue_request implementation
+	u64 now = ktime_get_ns();
 
-	Passenger * p = NULL;
-	struct list_head * temp;
-	struct list_head * dummy;
+	if (parm->Current_State == state)
+		return;
 
-	if (elevator.Current_State == IDLE)
-		INIT_LIST_HEAD(&list);
+	elev_count(parm, state_ns[parm->Current_State], now - parm->State_Since);
+	parm->State_Since = now;
+	parm->Current_State = state;
 
-	p = kmalloc(sizeof(Passenger), __GFP_RECLAIM);
+	if (state == IDLE || state == OFFLINE)
+		parm->Direction = 0;
 
-	printk(KERN_NOTICE "MY_ISSUE_REQUEST FUNCTION ENTERED\n");
+	eta_refresh(parm);
+	elev_event(parm, ELEVATOR_EVENT_STATE, NULL);
 
-	if (p_type < 1 || p_type > 4 ||
-	    start_floor < 1 || start_floor > 10 ||
-	    dest_floor < 1 || dest_floor > 10)
-	{
-		return 1;
-	}
+	// stop_elevator() sleeps until the car is OFFLINE
+	if (state == OFFLINE)
+		wake_up(&parm->Run_Wait);
+}
 
-	if (mutex_lock_interruptible(&elevator.mutex) == 0)
-	{
-		p->src = start_floor;
-		p->dst = dest_floor;
-		p->pass_units = 0;
-		p->weight_int = 0;
-		p->weight_dec = 0;
 
-		switch (p_type)
-		{
-			case 1:
-			{
-				p->pass_units = 1;
-				p->weight_int = 1;
-				p->weight_dec = 0;
-				break;
-			}
-		
-			case 2:
-			{
-				p->pass_units = 1;
-				p->weight_int = 0;
-				p->weight_dec = 5;
-				break;
-			}
-	
-			case 3:
-			{
-				p->pass_units = 2;
-				p->weight_int = 2;
-				p->weight_dec = 0;
-				break;
-			}
-			
-			case 4:
-			{
-				p->pass_units = 2;
-				p->weight_int = 3;
-				p->weight_dec = 0;
-				break;
-			}
-		}
-	}
-	mutex_unlock(&elevator.mutex);
+/* counters_read() sums the building's per-CPU counters into c; with
+ * since_start they count from the last start_elevator() on, and the
+ * time in the current state so far is included. Only since_start
+ * needs the mutex
+ */
+void counters_read(struct thread_parameter * parm, struct elev_counters * c,
+		   bool since_start)
+{
+	const u64 * cpu_c;
+	u64 * sum = (u64 *)c;
+	int cpu;
+	int i;
 
-	if (!stop)
+	memset(c, 0, sizeof(*c));
+
+	for_each_possible_cpu(cpu)
 	{
-		if (mutex_lock_interruptible(&elevator.mutex) == 0)
-		{
-			list_add_tail(&p->list, &list);
-			elevator.Waiting_Passengers[p->src - 1]++;
-		}
-		mutex_unlock(&elevator.mutex);
+		cpu_c = (const u64 *)per_cpu_ptr(parm->Counters, cpu);
 
-		if (elevator.Current_State == IDLE)
-		{
-			if (mutex_lock_interruptible(&elevator.mutex) == 0)
-			{
-				if (p->src == elevator.Current_Floor)
-				{
-					elevator.Current_State = LOADING;
-					elevator.Next_Floor = p->dst;
-				}
-			}
-			mutex_unlock(&elevator.mutex);
+		for (i = 0; i < sizeof(*c) / sizeof(u64); i++)
+			sum[i] += READ_ONCE(cpu_c[i]);
+	}
 
-			if (mutex_lock_interruptible(&elevator.mutex) == 0)
-			{
-				if (elevator.Current_Floor != p->src)
-					elevator.Next_Floor = p->src;
-			
-				if (elevator.Next_Floor > elevator.Current_Floor)
-					elevator.Current_State = UP;
-				else if (elevator.Next_Floor < elevator.Current_Floor)
-					elevator.Current_State = DOWN;
-			}
-			mutex_unlock(&elevator.mutex);
-		}
-		else if (elevator.Current_State == UP)
-		{
-			if (elevator.Current_Load.pass_units == 0)
-			{
-				if (mutex_lock_interruptible(&elevator.mutex) == 0)
-				{
-					list_for_each_safe(temp, dummy, &list)
-					{
-						p = list_entry(temp, Passenger, list);
-						elevator.Next_Floor = p->src;
-						break;
-					}		
+	if (!since_start)
+		return;
 
-					list_for_each_safe(temp, dummy, &list)
-					{
-						p = list_entry(temp, Passenger, list);
+	for (i = 0; i < sizeof(*c) / sizeof(u64); i++)
+		sum[i] -= ((const u64 *)&parm->Counters_Base)[i];
 
-						if (p->src > elevator.Current_Floor &&
-							p->src <= elevator.Next_Floor &&
-							p->dst > elevator.Current_Floor)
-    	    			{
-							elevator.Next_Floor = p->src;
-						}
-					}
-				}		
-				mutex_unlock(&elevator.mutex);
-			}
-		}
-		else if (elevator.Current_State == DOWN)
-		{
-			if (mutex_lock_interruptible(&elevator.mutex) == 0)
-			{
-				list_for_each_safe(temp, dummy, &list)
-				{
-					p = list_entry(temp, Passenger, list);
-							
-					if (p->src < elevator.Current_Floor &&
-						p->src >= elevator.Next_Floor &&
-						p->dst < elevator.Current_Floor)
-					{
-						elevator.Next_Floor = p->src;
-					}
-				}
-			}
-			mutex_unlock(&elevator.mutex);		
-		}
-	}
+	c->state_ns[parm->Current_State] += ktime_get_ns() - parm->State_Since;
+}
 
-	return 0;
+
+/* energy_mj() prices the travel in c with the energy_* parameters,
+ * in mJ
+ */
+u64 energy_mj(const struct elev_counters * c)
+{
+	return c->starts * READ_ONCE(energy_start_mj) +
+	       (c->floors_moved - c->floors_loaded) *
+			READ_ONCE(energy_floor_empty_mj) +
+	       c->floors_loaded * READ_ONCE(energy_floor_loaded_mj) +
+	       c->door_cycles * READ_ONCE(energy_door_mj);
 }
 
 
-/*************************************************************************/
+/* jitter_record() records a timed wakeup of the service thread that
+ * was due at due_ns (CLOCK_MONOTONIC)
+ */
+void jitter_record(struct thread_parameter * parm, u64 due_ns)
+{
+	u64 now = ktime_get_ns();
+	u64 late = now > due_ns ? now - due_ns : 0;
+	int bucket = min(fls64(div_u64(late, NSEC_PER_USEC)), JITTER_BUCKETS - 1);
 
+	elev_count(parm, jitter_ns, late);
+	elev_count(parm, jitter_hist[bucket], 1);
+}
 
-/* my_stop_elevator() defines the stop_elevator() system call;
- * it sets the elevator state to OFFLINE, but if there are still
- * passengers on the elevator, it takes them to their respective
- * dest_floors first
- */ 
-extern int (*STUB_stop_elevator)(void);
-int my_stop_elevator(void)
+
+/* jitter_percentile() returns the upper edge (in us) of the bucket
+ * holding the pct-th percentile of the wakeups counted in c, or 0 if
+ * there are none
+ */
+u64 jitter_percentile(const struct elev_counters * c, int pct)
 {
-	// stop_elevator implementation
-	
-/*
-	deactivates elevator, elevator will
-	process no more new requests, but will
-	offload all current passengers
-*/
+	u64 total = 0;
+	u64 rank;
+	u64 seen = 0;
+	int i;
 
-	if (mutex_lock_interruptible(&elevator.mutex) == 0)
-	{
-		stop = true;
-	}
-	mutex_unlock(&elevator.mutex);
+	for (i = 0; i < JITTER_BUCKETS; i++)
+		total += c->jitter_hist[i];
 
-	while (elevator.Current_Load.pass_units != 0){}
-	
-	if (mutex_lock_interruptible(&elevator.mutex) == 0)
+	if (total == 0)
+		return 0;
+
+	rank = div64_u64(total * pct + 99, 100);
+
+	for (i = 0; i < JITTER_BUCKETS; i++)
 	{
-		elevator.Current_State = OFFLINE;
-		elevator.Current_Floor = 0;
-		elevator.Next_Floor = 0;
+		seen += c->jitter_hist[i];
+		if (seen >= rank)
+			break;
 	}
-	mutex_unlock(&elevator.mutex);
 
-	return 0;
+	return 1ULL << i;
 }
 
 
 /*************************************************************************/
 
 
-/* the elevator_service() function is the main thread of operation for
- * the simulated elevator; it runs while the module is inserted, and
- * currently does not perfectly attend to passengers, but the code which
- * sets elevator.Next_Floor appears to have nothing wrong with it
+/* stats_account_load() charges the time since the last change of
+ * Current_Load to the busy and load-time counters; it must be called
+ * with the mutex held and before pass_units is modified
  */
-int elevator_service(void * data)
+void stats_account_load(struct thread_parameter * parm)
 {
-	struct thread_parameter * parm = data;
-	Passenger * p = NULL;
-	struct list_head * temp;
-	struct list_head * dummy;
-	
-	int i;
-	bool waiting = false;
+	u64 now = ktime_get_ns();
+	u64 delta = now - parm->Stats.last_load_change;
 
-	printk(KERN_NOTICE "ELEVATOR_SERVICE FUNCTION ENTERED\n");
+	if (parm->Current_Load.pass_units > 0)
+		parm->Stats.busy_ns += delta;
 
-	while (!kthread_should_stop())
-	{
-		if (parm->Current_State != OFFLINE && parm->Current_State != IDLE)
-		{
-			if (parm->Current_State == LOADING)
-			{
-				ssleep(1);
+	parm->Stats.load_ns += delta * parm->Current_Load.pass_units;
+	parm->Stats.last_load_change = now;
+}
+
+
+/* stats_hist_add() records n passengers who each took a duration
+ * (in ns) in a wait or ride time histogram
+ */
+void stats_hist_add(u32 * hist, u64 ns, int n)
+{
+	u64 bucket = div_u64(ns, STATS_HIST_WIDTH_MS * NSEC_PER_MSEC);
+
+	if (bucket >= STATS_HIST_BUCKETS)
+		bucket = STATS_HIST_BUCKETS - 1;
+
+	hist[bucket] += n;
+}
+
+
+/* stats_hist_percentile() returns the upper edge (in ms) of the
+ * bucket holding the pct-th percentile of a histogram, or 0 if
+ * the histogram is empty
+ */
+u64 stats_hist_percentile(const u32 * hist, int pct)
+{
+	u64 total = 0;
+	u64 rank;
+	u64 seen = 0;
+	int i;
+
+	for (i = 0; i < STATS_HIST_BUCKETS; i++)
+		total += hist[i];
+
+	if (total == 0)
+		return 0;
+
+	rank = div_u64(total * pct + 99, 100);
+
+	for (i = 0; i < STATS_HIST_BUCKETS; i++)
+	{
+		seen += hist[i];
+		if (seen >= rank)
+			break;
+	}
+
+	return (u64)(i + 1) * STATS_HIST_WIDTH_MS;
+}
+
+
+/* stats_account_wait() records the wait of group p, picked up at
+ * time now, overall and for the floor they waited on; the histogram
+ * gets every member at the group's mean wait
+ */
+void stats_account_wait(struct thread_parameter * parm, Passenger * p, u64 now)
+{
+	u64 oldest = now - p->issued_ns;
+	u64 wait = oldest * p->count - p->issued_spread_ns;
+	int f = p->src - 1;
+
+	parm->Stats.wait_ns += wait;
+	stats_hist_add(parm->Stats.wait_hist, div_u64(wait, p->count), p->count);
+
+	parm->Stats.floor_served[f] += p->count;
+	parm->Stats.floor_wait_ns[f] += wait;
+
+	if (oldest > parm->Stats.floor_wait_max_ns[f])
+		parm->Stats.floor_wait_max_ns[f] = oldest;
+}
+
+
+/* stats_fairness_permille() returns Jain's fairness index over the
+ * mean wait (in ms) of every floor that has had a pickup, in
+ * thousandths: 1000 when all floors wait equally long, down to
+ * 1000 / n when one of n floors does all the waiting
+ */
+u64 stats_fairness_permille(struct thread_parameter * parm)
+{
+	u64 mean;
+	u64 sum = 0;
+	u64 sum_sq = 0;
+	int n = 0;
+	int i;
+
+	for (i = 0; i < 10; i++)
+	{
+		if (parm->Stats.floor_served[i] == 0)
+			continue;
+
+		mean = div64_u64(parm->Stats.floor_wait_ns[i],
+				 parm->Stats.floor_served[i] * NSEC_PER_MSEC);
+		sum += mean;
+		sum_sq += mean * mean;
+		n++;
+	}
+
+	if (sum_sq == 0)
+		return 1000;
+
+	return div64_u64(sum * sum * 1000, sum_sq * n);
+}
+
+
+/* timing_read() takes one reading of the dwell and travel parameters */
+void timing_read(struct elev_timing * tm)
+{
+	tm->dwell_min_ms = READ_ONCE(dwell_min_ms);
+	tm->dwell_max_ms = READ_ONCE(dwell_max_ms);
+	tm->dwell_base_ms = READ_ONCE(dwell_base_ms);
+	tm->dwell_per_passenger_ms = READ_ONCE(dwell_per_passenger_ms);
+	tm->travel_floor_ms = READ_ONCE(travel_floor_ms);
+	tm->travel_accel_ms = READ_ONCE(travel_accel_ms);
+}
+
+
+/* purge_waiting() deletes every passenger still waiting on a floor,
+ * counting them as dropped; must be called with the mutex held
+ */
+void purge_waiting(struct thread_parameter * parm)
+{
+	struct list_head * temp;
+	struct list_head * dummy;
+	Passenger * p;
+	int i;
+
+	list_for_each_safe(temp, dummy, &parm->list)
+	{
+		p = list_entry(temp, Passenger, list);
+		elev_count(parm, dropped, p->count);
+		list_del(temp);
+		kfree(p);
+	}
+
+	for (i = 0; i < 10; i++)
+	{
+		parm->Waiting_Passengers[i] = 0;
+		parm->Calls[ETA_UP][i] = 0;
+		parm->Calls[ETA_DOWN][i] = 0;
+		INIT_LIST_HEAD(&parm->Floor_Waiting[i]);
+	}
+
+	memset(&parm->Trips, 0, sizeof(parm->Trips));
+}
+
+
+/* go_offline() drops everyone still waiting and takes the elevator
+ * OFFLINE; must be called with the mutex held
+ */
+void go_offline(struct thread_parameter * parm)
+{
+	purge_waiting(parm);
+	parm->Current_Floor = 0;
+	parm->Next_Floor = 0;
+	set_state(parm, OFFLINE);
+}
+
+
+/*************************************************************************/
+
+
+/* start_locked() sets the elevator's state to IDLE, as it
+ * is no longer OFFLINE, and puts the elevator at floor 1, with
+ * zero passengers on it or waiting on any floor; returns 1 if the
+ * elevator was already running or its building is being destroyed.
+ * Must be called with the mutex held
+ */
+int start_locked(struct thread_parameter * parm)
+{
+	int i;
+
+	if (parm->Current_State != OFFLINE || parm->Removed)
+		return 1;
+
+	parm->Current_Floor = 1;
+	parm->Next_Floor = 1;
+	parm->Current_Load.pass_units = 0;
+	parm->Current_Load.weight_int = 0;
+	parm->Current_Load.weight_dec = 0;
+	parm->stop = false;
+
+	for (i = 0; i < 10; i++)
+	{
+		parm->Waiting_Passengers[i] = 0;
+		parm->Riders_To[i] = 0;
+		parm->Calls[ETA_UP][i] = 0;
+		parm->Calls[ETA_DOWN][i] = 0;
+	}
+
+	memset(&parm->Trips, 0, sizeof(parm->Trips));
+
+	// every start begins a fresh measurement run
+	memset(&parm->Stats, 0, sizeof(parm->Stats));
+	counters_read(parm, &parm->Counters_Base, false);
+	parm->State_Since = ktime_get_ns();
+	parm->Stats.online_since = ktime_get_ns();
+	parm->Stats.last_load_change = parm->Stats.online_since;
+
+	set_state(parm, IDLE);
+
+	return 0;
+}
+
+
+/* my_start_elevator() defines the start_elevator() system call;
+ * building is the handle listed in /proc/elevator/buildings
+ */
+int my_start_elevator(int building)
+{
+	// start_elevator implementation
+	
+	struct thread_parameter * parm = building_get(building);
+	int ret;
+
+	if (parm == NULL)
+		return -ENOENT;
+
+	if (elev_lock(parm, LOCK_START) != 0)
+	{
+		building_put(parm);
+		return -EINTR;
+	}
+
+	ret = start_locked(parm);
+
+	elev_unlock(parm, LOCK_START);
+	building_put(parm);
+	
+	return ret;
+}
+
+
+/*************************************************************************/
+
+
+/* stop_books_init() points b at the counts of the building that
+ * board_walk() and friends keep in step
+ */
+void stop_books_init(struct stop_books * b, struct thread_parameter * parm)
+{
+	b->load = &parm->Current_Load;
+	b->waiting = parm->Waiting_Passengers;
+	b->riders_to = parm->Riders_To;
+	b->calls = parm->Calls;
+	b->trips = &parm->Trips;
+}
+
+
+/* the stop_hooks of a building: the counters, statistics and events
+ * of every group that boards or alights. Called with the mutex held
+ */
+void stop_board(void * ctx, Passenger * p, u64 now)
+{
+	struct thread_parameter * parm = ctx;
+
+	stats_account_load(parm);
+	elev_count(parm, boarded, p->count);
+	stats_account_wait(parm, p, now);
+	elev_event(parm, ELEVATOR_EVENT_BOARD, p);
+}
+
+
+void stop_alight(void * ctx, Passenger * p, u64 now)
+{
+	struct thread_parameter * parm = ctx;
+
+	stats_account_load(parm);
+	elev_count(parm, delivered, p->count);
+	elev_count(parm, delivered_from[p->src - 1], p->count);
+	parm->Stats.ride_ns += (now - p->boarded_ns) * p->count;
+	stats_hist_add(parm->Stats.ride_hist, now - p->boarded_ns, p->count);
+	elev_event(parm, ELEVATOR_EVENT_ALIGHT, p);
+}
+
+
+void stop_arrive(void * ctx, Passenger * p, u64 now)
+{
+	struct thread_parameter * parm = ctx;
+
+	elev_count(parm, delivered, p->count);
+	elev_count(parm, delivered_from[p->src - 1], p->count);
+	stats_account_wait(parm, p, now);
+	stats_hist_add(parm->Stats.ride_hist, 0, p->count);
+	elev_event(parm, ELEVATOR_EVENT_BOARD, p);
+	elev_event(parm, ELEVATOR_EVENT_ALIGHT, p);
+}
+
+
+/* load_elev() loads all qualifying passengers onto elevator
+ * (must be on the same floor as the elevator and be able to fit)
+ * with board_walk(): each waiting group is checked on its own, so
+ * everyone who fits boards at the same stop, and a group that only
+ * partly fits is split. Returns the number of passengers who got on
+ * (or were done on arrival)
+ */
+int load_elev(struct thread_parameter * parm)
+{
+	struct stop_hooks h = { stop_board, stop_alight, stop_arrive, parm };
+	struct stop_books b;
+	int moved = 0;
+
+	if (elev_lock(parm, LOCK_LOAD) == 0)
+	{
+		stop_books_init(&b, parm);
+		parm->Stop_Walked += board_walk(&b,
+			&parm->Floor_Waiting[parm->Current_Floor - 1],
+			&parm->elev, parm->Current_Floor, ktime_get_ns(), &h,
+			&moved);
+
+		elev_unlock(parm, LOCK_LOAD);
+	}
+
+	return moved;
+}
+
+
+/* unload_elev() removes a passenger from the elevator as long
+ * they are on their destination floor (removing them from elev),
+ * with alight_walk(); returns the number of passengers who got off
+ */ 
+int unload_elev(struct thread_parameter * parm)
+{
+	struct stop_hooks h = { stop_board, stop_alight, stop_arrive, parm };
+	struct stop_books b;
+	int moved = 0;
+
+	if (elev_lock(parm, LOCK_UNLOAD) == 0)
+	{
+		stop_books_init(&b, parm);
+		parm->Stop_Walked += alight_walk(&b, &parm->elev,
+			parm->Current_Floor, ktime_get_ns(), &h, &moved);
+
+		elev_unlock(parm, LOCK_UNLOAD);
+	}
+
+	return moved;
+}
+
+
+/*************************************************************************/
+
+
+/* check_fail() counts and logs a failed invariant; returns 1 */
+int check_fail(struct thread_parameter * parm, const char * what)
+{
+	elev_count(parm, invariant_violations, 1);
+	pr_warn_ratelimited("elevator %s: %s\n", parm->Name, what);
+
+	return 1;
+}
+
+
+/* check_locked() checks the dispatch invariants (see
+ * check_invariants) once a stop is done; returns how many failed.
+ * Must be called with the mutex held
+ */
+int check_locked(struct thread_parameter * parm)
+{
+	struct elev_counters c;
+	struct list_head * temp;
+	Passenger * p;
+	int riders[10] = { 0 };
+	int units = 0;
+	int waiting;
+	int trips;
+	int failed = 0;
+	u64 queued = 0;
+	u64 riding = 0;
+	int i;
+	int j;
+
+	list_for_each(temp, &parm->elev)
+	{
+		p = list_entry(temp, Passenger, list);
+		units += p->count * p->pass_units;
+		riders[p->dst - 1] += p->count;
+		riding += p->count;
+	}
+
+	if (parm->Current_Load.pass_units > MAX_PASSENGER_UNITS ||
+	    load_halves(1, parm->Current_Load.weight_int,
+			parm->Current_Load.weight_dec) >
+	    load_halves(1, MAX_WEIGHT_INT, MAX_WEIGHT_DEC))
+		failed += check_fail(parm, "car over capacity");
+
+	if (units != parm->Current_Load.pass_units)
+		failed += check_fail(parm, "load does not match riders");
+
+	for (i = 0; i < 10; i++)
+	{
+		if (riders[i] != parm->Riders_To[i])
+			failed += check_fail(parm, "riders by floor out of step");
+
+		waiting = 0;
+		list_for_each(temp, &parm->Floor_Waiting[i])
+		{
+			p = list_entry(temp, Passenger, floor);
+			if (p->src != i + 1)
+				failed += check_fail(parm, "group on the wrong floor");
+
+			waiting += p->count;
+		}
+
+		trips = 0;
+		for (j = 0; j < 10; j++)
+		{
+			trips += parm->Trips.count[i][j];
+
+			if ((parm->Trips.count[i][j] > 0) !=
+			    !!(parm->Trips.dst_mask[i] & (1 << j)))
+				failed += check_fail(parm, "trip mask out of step");
+		}
+
+		if (waiting != parm->Waiting_Passengers[i] || trips != waiting)
+			failed += check_fail(parm, "floor queue out of step");
+
+		queued += waiting;
+	}
+
+	// every passenger taken since the start is waiting, riding,
+	// delivered or dropped, exactly once
+	counters_read(parm, &c, true);
+	if (c.issued != queued + riding + c.delivered + c.dropped)
+		failed += check_fail(parm, "passengers lost or counted twice");
+
+	if (parm->Stop_Walked > STOP_WALK_BOUND)
+		failed += check_fail(parm, "stop walked too many groups");
+
+	return failed;
+}
+
+
+/*************************************************************************/
+
+
+/* choose_direction() sends the car off from a stop towards
+ * Next_Floor, as seeded by elevator_service(), with plan_direction();
+ * a passenger who has waited max_wait_ms makes their floor the seed
+ * and the car does not run past it. Must be called with the mutex held
+ */
+void choose_direction(struct thread_parameter * parm)
+{
+	u64 bound = (u64)READ_ONCE(max_wait_ms) * NSEC_PER_MSEC;
+	int starved = starved_floor(&parm->list, parm->Current_Floor,
+				    ktime_get_ns(), bound);
+
+	if (starved > 0)
+		elev_count(parm, starved_runs, 1);
+
+	if (plan_direction(&parm->Current_Load, parm->Riders_To, &parm->Trips,
+			   parm->Current_Floor, parm->Next_Floor, starved,
+			   &parm->Next_Floor) > 0)
+		set_state(parm, UP);
+	else
+		set_state(parm, DOWN);
+}
+
+
+/*************************************************************************/
+
+
+/* new_passenger() allocates a passenger of type p_type travelling
+ * from src to dst; returns NULL if memory is short
+ */
+Passenger * new_passenger(int p_type, int src, int dst)
+{
+	Passenger * p = kmalloc(sizeof(Passenger), __GFP_RECLAIM);
+
+	if (p == NULL)
+		return NULL;
+
+	p->src = src;
+	p->dst = dst;
+	p->p_type = p_type;
+	p->count = 1;
+	p->issued_spread_ns = 0;
+	p->pass_units = 0;
+	p->weight_int = 0;
+	p->weight_dec = 0;
+
+	switch (p_type)
+	{
+		case 1:
+		{
+			p->pass_units = 1;
+			p->weight_int = 1;
+			p->weight_dec = 0;
+			break;
+		}
+	
+		case 2:
+		{
+			p->pass_units = 1;
+			p->weight_int = 0;
+			p->weight_dec = 5;
+			break;
+		}
+
+		case 3:
+		{
+			p->pass_units = 2;
+			p->weight_int = 2;
+			p->weight_dec = 0;
+			break;
+		}
+		
+		case 4:
+		{
+			p->pass_units = 2;
+			p->weight_int = 3;
+			p->weight_dec = 0;
+			break;
+		}
+	}
+
+	return p;
+}
+
+
+/* valid_request() checks the arguments of an issue_request() call */
+bool valid_request(int p_type, int start_floor, int dest_floor)
+{
+	return p_type >= 1 && p_type <= 4 &&
+	       start_floor >= 1 && start_floor <= 10 &&
+	       dest_floor >= 1 && dest_floor <= 10;
+}
+
+
+/* issue_locked() queues passenger p on their floor, in the group of
+ * an identical trip if one is waiting, and points the elevator at
+ * them if needed; returns 0 if p was accepted (the elevator then owns
+ * p, and frees it at once if it joined a group) or 1 if it was
+ * refused, in which case the caller frees p. Must be called with the
+ * mutex held; the caller wakes parm->Run_Wait after dropping it
+ */
+int issue_locked(struct thread_parameter * parm, Passenger * p)
+{
+	struct stop_books b;
+	Passenger * w;
+	int start_floor = p->src;
+	int dest_floor = p->dst;
+	enum States target;
+	int old_next;
+	int next;
+
+	// requests are only taken while the elevator is online and
+	// stop_elevator has not been called
+	if (parm->stop || parm->Current_State == OFFLINE)
+	{
+		elev_count(parm, rejected, 1);
+		return 1;
+	}
+
+	p->issued_ns = ktime_get_ns();
+	elev_count(parm, issued, 1);
+	elev_event(parm, ELEVATOR_EVENT_REQUEST, p);
+
+	// a group waits where its passengers do
+	stop_books_init(&b, parm);
+	queue_group(&b, &parm->list, &parm->Floor_Waiting[p->src - 1], p);
+
+	if (parm->Current_State == IDLE)
+	{
+		// settle on the state first, so listeners see one change
+		if (start_floor == parm->Current_Floor)
+		{
+			target = LOADING;
+			parm->Next_Floor = dest_floor;
+		}
+		else
+		{
+			target = IDLE;
+			parm->Next_Floor = start_floor;
+		}
+
+		if (parm->Next_Floor > parm->Current_Floor)
+			target = UP;
+		else if (parm->Next_Floor < parm->Current_Floor)
+			target = DOWN;
+
+		set_state(parm, target);
+	}
+	else if (parm->Current_State == UP)
+	{
+		if (parm->Current_Load.pass_units == 0)
+		{
+			old_next = parm->Next_Floor;
+
+			// head for the oldest call, picking up on the way
+			w = list_first_entry(&parm->list, Passenger, list);
+			parm->Next_Floor = w->src;
+
+			next = nearest_call_up(&parm->Trips, parm->Current_Floor,
+					       parm->Next_Floor);
+			if (next > 0)
+				parm->Next_Floor = next;
+
+			if (parm->Next_Floor != old_next)
+				parm->Run_Replan = true;
+		}
+	}
+	else if (parm->Current_State == DOWN)
+	{
+		old_next = parm->Next_Floor;
+
+		next = nearest_call_down(&parm->Trips, parm->Current_Floor,
+					 parm->Next_Floor);
+		if (next > 0)
+			parm->Next_Floor = next;
+
+		if (parm->Next_Floor != old_next)
+			parm->Run_Replan = true;
+	}
+
+	// a new call is a new stop for everyone behind it
+	eta_refresh(parm);
+
+	return 0;
+}
+
+
+/* issue_elev() queues a request with the elevator of one building;
+ * returns 0 if it was accepted, 1 if it was refused
+ */
+int issue_elev(struct thread_parameter * parm, int p_type,
+	       int start_floor, int dest_floor)
+{
+	Passenger * p = NULL;
+	int ret;
+
+	if (!valid_request(p_type, start_floor, dest_floor))
+	{
+		elev_count(parm, rejected, 1);
+		return 1;
+	}
+
+	p = new_passenger(p_type, start_floor, dest_floor);
+	if (p == NULL)
+		return -ENOMEM;
+
+	if (elev_lock(parm, LOCK_ISSUE) != 0)
+	{
+		kfree(p);
+		return -EINTR;
+	}
+
+	ret = issue_locked(parm, p);
+
+	elev_unlock(parm, LOCK_ISSUE);
+
+	if (ret != 0)
+	{
+		// the request is refused
+		kfree(p);
+		return 1;
+	}
+
+	// let the service thread leave IDLE or replan its run
+	wake_up(&parm->Run_Wait);
+
+	return 0;
+}
+
+
+/* my_issue_request() defines the issue_request() system call */
+int my_issue_request(int building, int p_type, int start_floor,
+		     int dest_floor)
+{
+	// issue_request implementation
+
+	struct thread_parameter * parm = building_get(building);
+	int ret;
+
+	if (parm == NULL)
+		return -ENOENT;
+
+	ret = issue_elev(parm, p_type, start_floor, dest_floor);
+
+	building_put(parm);
+	return ret;
+}
+
+
+/*************************************************************************/
+
+
+/* stop_locked() makes the elevator process no more new requests;
+ * an idle elevator goes OFFLINE straight away, otherwise the service
+ * thread offloads the current passengers first and takes it OFFLINE
+ * once it is empty. Must be called with the mutex held
+ */
+void stop_locked(struct thread_parameter * parm)
+{
+	parm->stop = true;
+
+	if (parm->Current_State == IDLE)
+		go_offline(parm);
+}
+
+
+/* my_stop_elevator() defines the stop_elevator() system call;
+ * it sets the elevator state to OFFLINE, but if there are still
+ * passengers on the elevator, it takes them to their respective
+ * dest_floors first; the call returns once the elevator is OFFLINE,
+ * and passengers still waiting are dropped. A signal ends the wait
+ * with -ERESTARTSYS; the stop itself still goes ahead
+ */ 
+int my_stop_elevator(int building)
+{
+	// stop_elevator implementation
+	
+	struct thread_parameter * parm = building_get(building);
+	int ret;
+
+	if (parm == NULL)
+		return -ENOENT;
+
+	if (elev_lock(parm, LOCK_STOP) != 0)
+	{
+		building_put(parm);
+		return -EINTR;
+	}
+
+	stop_locked(parm);
+	elev_unlock(parm, LOCK_STOP);
+
+	// destroying the building also takes it OFFLINE
+	ret = wait_event_interruptible(parm->Run_Wait,
+		READ_ONCE(parm->Current_State) == OFFLINE);
+
+	building_put(parm);
+	return ret;
+}
+
+
+/*************************************************************************/
+
+
+/* eta_refresh() rebuilds the ETA table from the car's state and the
+ * pending stops, following the car the way it sweeps: on in its
+ * direction to the last stop that way, back to the last stop the other
+ * way, and round again. It is called on every state change and
+ * whenever the stops change, so reading an estimate only subtracts the
+ * time since Eta_At. Must be called with the mutex held
+ */
+void eta_refresh(struct thread_parameter * parm)
+{
+	struct elev_timing tm;
+	int riders[10];
+	int calls[2][10];
+	int dir = parm->Direction;
+	int last = parm->Current_Floor;
+	int f;
+	u64 elapsed;
+	u64 t = 0;
+
+	timing_read(&tm);
+	parm->Eta_At = ktime_get_ns();
+	eta_clear(parm->Eta);
+
+	// a stopping elevator takes no new calls
+	if (parm->Current_State == OFFLINE || parm->stop || last < 1 ||
+		last > 10)
+		return;
+
+	// an idle car goes straight to whoever calls
+	if (parm->Current_State == IDLE)
+	{
+		for (f = 1; f <= 10; f++)
+		{
+			t = run_time_ms(&tm, abs(f - last));
+			eta_set(parm->Eta, 1, f, t);
+			eta_set(parm->Eta, -1, f, t);
+		}
+
+		return;
+	}
+
+	memcpy(riders, parm->Riders_To, sizeof(riders));
+	memcpy(calls, parm->Calls, sizeof(calls));
+
+	if (dir == 0)
+		dir = parm->Next_Floor < last ? -1 : 1;
+
+	// a car under way (or about to leave) first finishes its run
+	if ((parm->Current_State == UP || parm->Current_State == DOWN) &&
+		parm->Next_Floor >= 1 && parm->Next_Floor <= 10)
+	{
+		dir = parm->Current_State == UP ? 1 : -1;
+		elapsed = parm->Run_Started == 0 ? 0 :
+			div_u64(parm->Eta_At - parm->Run_Started, NSEC_PER_MSEC);
+		t = run_time_ms(&tm, abs(parm->Next_Floor - last));
+		t = t > elapsed ? t - elapsed : 0;
+		last = parm->Next_Floor;
+	}
+
+	// the doors open on the floor the car is at or heading for
+	eta_sweep(parm->Eta, &tm, riders, calls, dir, last, t);
+}
+
+
+/* eta_remaining() returns the ms left until the car can pick up a
+ * call on floor f in direction dir (ETA_UP or ETA_DOWN), or -1 if
+ * there is no estimate; must be called with the mutex held
+ */
+long eta_remaining(struct thread_parameter * parm, int dir, int f)
+{
+	u32 eta = parm->Eta[dir][f - 1];
+	u64 since = div_u64(ktime_get_ns() - parm->Eta_At, NSEC_PER_MSEC);
+
+	if (eta == ETA_UNKNOWN)
+		return -1;
+
+	return eta > since ? eta - since : 0;
+}
+
+
+/* my_elevator_eta() defines the elevator_eta() system call: the ms
+ * until the car of the given building can pick up a request from
+ * start_floor to dest_floor made now, -ENODATA if the elevator takes
+ * no requests, or -EINVAL for floors outside the building
+ */
+int my_elevator_eta(int building, int start_floor, int dest_floor)
+{
+	struct thread_parameter * parm;
+	long ret;
+
+	if (!valid_request(1, start_floor, dest_floor))
+		return -EINVAL;
+
+	parm = building_get(building);
+	if (parm == NULL)
+		return -ENOENT;
+
+	if (elev_lock(parm, LOCK_ETA) != 0)
+	{
+		building_put(parm);
+		return -EINTR;
+	}
+
+	ret = eta_remaining(parm, dest_floor < start_floor ? ETA_DOWN : ETA_UP,
+			    start_floor);
+
+	elev_unlock(parm, LOCK_ETA);
+	building_put(parm);
+
+	return ret < 0 ? -ENODATA : min_t(long, ret, INT_MAX);
+}
+
+
+/* elevator_run() moves the car from Current_Floor to Next_Floor in
+ * direction dir (1 for UP, -1 for DOWN) as a single timed transition.
+ * While under way, my_issue_request() may move Next_Floor to a stop
+ * ahead of the car; the run is shortened to that stop if the car has
+ * not yet started braking for it, otherwise the new stop is left for
+ * a later run. Ends in LOADING at the floor reached
+ */
+void elevator_run(struct thread_parameter * parm, int dir)
+{
+	struct elev_timing tm;
+	int origin;
+	int target;
+	int next;
+	unsigned int duration;
+	unsigned int elapsed;
+	bool loaded;
+	bool slept = false;
+	u64 start;
+
+	if (elev_lock(parm, LOCK_SERVICE_DEPART) != 0)
+		return;
+
+	origin = parm->Current_Floor;
+	target = parm->Next_Floor;
+	parm->Run_Replan = false;
+
+	// a stop behind the car is not a run in this direction
+	if ((target - origin) * dir < 0)
+	{
+		target = origin;
+		parm->Next_Floor = origin;
+	}
+
+	start = ktime_get_ns();
+	loaded = parm->Current_Load.pass_units > 0;
+	parm->Direction = dir;
+	parm->Run_Started = start;
+	eta_refresh(parm);
+
+	elev_unlock(parm, LOCK_SERVICE_DEPART);
+
+	timing_read(&tm);
+	duration = run_time_ms(&tm, (target - origin) * dir);
+
+	while (!kthread_should_stop())
+	{
+		elapsed = div_u64(ktime_get_ns() - start, NSEC_PER_MSEC);
+		if (elapsed >= duration)
+		{
+			if (slept)
+				jitter_record(parm,
+					start + (u64)duration * NSEC_PER_MSEC);
+			break;
+		}
+
+		// an hrtimer, so the arrival is not rounded to a tick
+		wait_event_interruptible_hrtimeout(parm->Run_Wait,
+			READ_ONCE(parm->Run_Replan) || kthread_should_stop(),
+			ms_to_ktime(duration - elapsed));
+		slept = true;
+
+		if (!READ_ONCE(parm->Run_Replan))
+			continue;
+
+		if (elev_lock(parm, LOCK_SERVICE_REPLAN) == 0)
+		{
+			parm->Run_Replan = false;
+			next = parm->Next_Floor;
+			elapsed = div_u64(ktime_get_ns() - start, NSEC_PER_MSEC);
+
+			if ((next - origin) * dir > 0 && (target - next) * dir > 0 &&
+				elapsed + brake_time_ms(&tm, (next - origin) * dir) <=
+				run_time_ms(&tm, (next - origin) * dir))
+			{
+				target = next;
+				duration = run_time_ms(&tm, (target - origin) * dir);
+				elev_count(parm, replans, 1);
+			}
+			else
+			{
+				parm->Next_Floor = target;
+			}
+
+			eta_refresh(parm);
+			elev_unlock(parm, LOCK_SERVICE_REPLAN);
+		}
+	}
+
+	if (elev_lock(parm, LOCK_SERVICE_ARRIVE) == 0)
+	{
+		parm->Current_Floor = target;
+		parm->Next_Floor = target;
+		parm->Run_Started = 0;
+		elev_count(parm, runs, 1);
+		elev_count(parm, run_ns, ktime_get_ns() - start);
+		elev_count(parm, floors_moved, abs(target - origin));
+
+		// nobody boards or alights between stops
+		if (loaded)
+			elev_count(parm, floors_loaded, abs(target - origin));
+
+		if (target != origin)
+			elev_count(parm, starts, 1);
+		elev_event(parm, ELEVATOR_EVENT_ARRIVE, NULL);
+
+		if (parm->Current_State == UP || parm->Current_State == DOWN)
+			set_state(parm, LOADING);
+
+		elev_unlock(parm, LOCK_SERVICE_ARRIVE);
+	}
+}
+
+
+/*************************************************************************/
+
+
+/* the elevator_service() function is the main thread of operation for
+ * the simulated elevator; it runs while the module is inserted, and
+ * currently does not perfectly attend to passengers, but the code which
+ * sets parm->Next_Floor appears to have nothing wrong with it
+ */
+int elevator_service(void * data)
+{
+	struct thread_parameter * parm = data;
+	struct elev_timing tm;
+	Passenger * p = NULL;
+	struct list_head * temp;
+	struct list_head * dummy;
+	
+	int i;
+	int moved;
+	unsigned int dwell;
+	u64 due;
+	bool waiting = false;
+
+	while (!kthread_should_stop())
+	{
+		if (parm->Current_State != OFFLINE && parm->Current_State != IDLE)
+		{
+			if (parm->Current_State == LOADING)
+			{
+				moved = 0;
+
+				// every pass counts its own walk, whether or not
+				// anyone rides in to unload
+				parm->Stop_Walked = 0;
 
 				// if there are passengers on elevator, call unload_elev
 				if (parm->Current_Load.pass_units > 0)
-					unload_elev(p);
+					moved += unload_elev(parm);
 			
-				if (!stop)
+				if (!parm->stop)
 				{
 					// if stop_elevator hasn't been called, call load_elev
-					load_elev(p);
+					moved += load_elev(parm);
 				}
 				else
 				{
 					// if stop_elevator has been called, delete
 					// all waiting passengers from list
-					if (mutex_lock_interruptible(&parm->mutex) == 0)
+					if (elev_lock(parm, LOCK_SERVICE_PURGE) == 0)
 					{
-						list_for_each_safe(temp, dummy, &list)
-						{
-							p = list_entry(temp, Passenger, list);
-							list_del(temp);
-							kfree(p);
-						}
+						purge_waiting(parm);
+
+						elev_unlock(parm, LOCK_SERVICE_PURGE);
 					}
-					mutex_unlock(&elevator.mutex);
 				}
+
+				if (READ_ONCE(check_invariants) &&
+				    elev_lock(parm, LOCK_SERVICE_CHECK) == 0)
+				{
+					check_locked(parm);
+
+					elev_unlock(parm, LOCK_SERVICE_CHECK);
+				}
+
+				// hold the doors for as long as the work at this
+				// stop takes
+				timing_read(&tm);
+				dwell = stop_dwell_ms(&tm, moved);
+				if (dwell > 0)
+				{
+					due = ktime_get_ns() + (u64)dwell * NSEC_PER_MSEC;
+					usleep_range(dwell * USEC_PER_MSEC,
+						     dwell * USEC_PER_MSEC + DWELL_SLACK_US);
+					jitter_record(parm, due);
+				}
+
+				elev_count(parm, stops, 1);
+				if (dwell > 0)
+					elev_count(parm, door_cycles, 1);
+				elev_count(parm, dwell_ns, (u64)dwell * NSEC_PER_MSEC);
+				elev_count(parm, dwell_saved_ns,
+					((s64)LEGACY_DWELL_MS - dwell) * NSEC_PER_MSEC);
 	
-				if (mutex_lock_interruptible(&parm->mutex) == 0)
+				waiting = false;
+
+				if (elev_lock(parm, LOCK_SERVICE_SCAN) == 0)
 				{
 					for (i = 0; i < 10; i++)
 					{
 						if (parm->Waiting_Passengers[i] > 0)
 							waiting = true;			
 					}
+
+					elev_unlock(parm, LOCK_SERVICE_SCAN);
 				}
-				mutex_unlock(&elevator.mutex);
 	
 				// if there are no passengers on elevator
 				// and no passengers waiting on any floor
 				if (parm->Current_Load.pass_units == 0 && !waiting)
 				{
-					if (mutex_lock_interruptible(&parm->mutex) == 0)
-					{		
-						parm->Current_State = IDLE;
+					if (elev_lock(parm, LOCK_SERVICE_IDLE) == 0)
+					{
+						// a request that came in since the scan
+						// keeps the car in LOADING for another pass
+						if (parm->stop)
+							go_offline(parm);
+						else if (list_empty(&parm->list))
+							set_state(parm, IDLE);
+
+						elev_unlock(parm, LOCK_SERVICE_IDLE);
 					}
-					mutex_unlock(&elevator.mutex);
 				}
 				// if there are passengers on the elevator
 				// and no passengers waiting on any floor
 				else if (parm->Current_Load.pass_units > 0 && !waiting)
 				{
-					if (mutex_lock_interruptible(&parm->mutex) == 0)
+					if (elev_lock(parm, LOCK_SERVICE_SEED) == 0)
 					{
-						list_for_each_safe(temp, dummy, &elev)
+						list_for_each_safe(temp, dummy, &parm->elev)
 						{
 							p = list_entry(temp, Passenger, list);
 
 							parm->Next_Floor = p->dst;
 							break;
-						}	
+						}
+
+						elev_unlock(parm, LOCK_SERVICE_SEED);
 					}
-					mutex_unlock(&elevator.mutex);
 						
-					if (mutex_lock_interruptible(&parm->mutex) == 0)
+					if (elev_lock(parm, LOCK_SERVICE_DIRECTION) == 0)
 					{
-						if (parm->Next_Floor > parm->Current_Floor)
-						{
-							if (find_next_floor_up(
-								parm->Current_Floor) > 0)
-							{
-								parm->Next_Floor =
-								find_next_floor_up(
-								parm->Current_Floor);
-							}
-
-							parm->Current_State = UP;
-						}
-						else
-						{
-							if (find_next_floor_down(
-								parm->Current_Floor) > 0)
-							{
-								parm->Next_Floor =
-								find_next_floor_down(
-								parm->Current_Floor);
-							}
-								
-							parm->Current_State = DOWN;
-						}
+						choose_direction(parm);
+
+						elev_unlock(parm, LOCK_SERVICE_DIRECTION);
 					}
-					mutex_unlock(&elevator.mutex);	
 				}
 				// if there are no passengers on the elevator
 				// and at least one passenger is waiting on a floor
 				else if (parm->Current_Load.pass_units == 0 && waiting)
 				{
-					if (mutex_lock_interruptible(&parm->mutex) == 0)
+					if (elev_lock(parm, LOCK_SERVICE_SEED) == 0)
 					{
-						list_for_each_safe(temp, dummy, &list)
+						list_for_each_safe(temp, dummy, &parm->list)
 						{
 							p = list_entry(temp, Passenger, list);
 							parm->Next_Floor = p->src;
 
 							break;
 						}
+
+						elev_unlock(parm, LOCK_SERVICE_SEED);
 					}
-					mutex_unlock(&elevator.mutex);
 
-					if (mutex_lock_interruptible(&parm->mutex) == 0)
+					if (elev_lock(parm, LOCK_SERVICE_DIRECTION) == 0)
 					{
-						if (parm->Next_Floor > parm->Current_Floor)
-						{
-							if (find_next_floor_up(
-								parm->Current_Floor) > 0)
-							{
-								parm->Next_Floor =
-								find_next_floor_up(
-								parm->Current_Floor);
-							}
-
-							parm->Current_State = UP;
-						}
-						else
-						{
-							if (find_next_floor_down(
-								parm->Current_Floor) > 0)
-							{
-								parm->Next_Floor =
-								find_next_floor_down(
-								parm->Current_Floor);
-							}
-	
-							parm->Current_State = DOWN;
-						}
+						choose_direction(parm);
+
+						elev_unlock(parm, LOCK_SERVICE_DIRECTION);
 					}
-					mutex_unlock(&elevator.mutex);
 				}
 				// if there is at least one passenger on the elevator
 				// and at least one passenger waiting on a floor
 				else
 				{
-					if (mutex_lock_interruptible(&parm->mutex) == 0)
+					if (elev_lock(parm, LOCK_SERVICE_SEED) == 0)
 					{
-						list_for_each_safe(temp, dummy, &elev)
+						list_for_each_safe(temp, dummy, &parm->elev)
 						{
 							p = list_entry(temp, Passenger, list);
 							parm->Next_Floor = p->dst;
 
 							break;
 						}
+
+						elev_unlock(parm, LOCK_SERVICE_SEED);
 					}
-					mutex_unlock(&elevator.mutex);
 
-					if (mutex_lock_interruptible(&parm->mutex) == 0)
+					if (elev_lock(parm, LOCK_SERVICE_DIRECTION) == 0)
 					{
-						if (parm->Next_Floor > parm->Current_Floor)
-						{
-							if (find_next_floor_up(
-								parm->Current_Floor) > 0)
-							{
-								parm->Next_Floor =
-								find_next_floor_up(
-								parm->Current_Floor);
-							}
-					
-							parm->Current_State = UP;
-						}
-						else
-						{
-							if (find_next_floor_down(
-								parm->Current_Floor) > 0)
-							{
-								parm->Next_Floor =
-								find_next_floor_down(
-								parm->Current_Floor);
-							}
-
-							parm->Current_State = DOWN;
-						}
+						choose_direction(parm);
+
+						elev_unlock(parm, LOCK_SERVICE_DIRECTION);
 					}
-					mutex_unlock(&elevator.mutex);		
 				}
 			}
 			else if (parm->Current_State == UP)
 			{
-				while (parm->Current_Floor != parm->Next_Floor)
-				{
-					ssleep(2);
-					
-					if (mutex_lock_interruptible(&parm->mutex) == 0)
-					{
-						parm->Current_Floor++;
-					}
-					mutex_unlock(&elevator.mutex);
-				}
+				elevator_run(parm, 1);
+			}
+
+			else // (parm->Current_State == DOWN)
+			{
+				elevator_run(parm, -1);
+			}
+		}
+		else
+		{
+			// nothing to do until a request or start_elevator
+			// changes the state; the timeout is only a safety net
+			wait_event_interruptible_timeout(parm->Run_Wait,
+				(READ_ONCE(parm->Current_State) != OFFLINE &&
+				 READ_ONCE(parm->Current_State) != IDLE) ||
+				kthread_should_stop(), HZ);
+		}
+	}
+		
+	return 0;
+}
+
+
+/* service_set_policy() gives the building's (not yet woken) service
+ * thread its scheduling policy: SCHED_FIFO at the middle realtime
+ * priority, SCHED_DEADLINE with the deadline_* budget, or left as
+ * created (SCHED_NORMAL); returns 0 or the scheduler's error, such as
+ * -EPERM for a deadline thread pinned to one CPU
+ */
+int service_set_policy(struct thread_parameter * parm)
+{
+	struct sched_attr attr =
+	{
+		.size = sizeof(attr),
+		.sched_policy = SCHED_DEADLINE,
+		.sched_runtime = (u64)deadline_runtime_us * NSEC_PER_USEC,
+		.sched_deadline = (u64)deadline_period_us * NSEC_PER_USEC,
+		.sched_period = (u64)deadline_period_us * NSEC_PER_USEC,
+	};
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 9, 0)
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO / 2 };
+#endif
+
+	switch (parm->Policy)
+	{
+		case POLICY_FIFO:
+		{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+			sched_set_fifo(parm->kthread);
+			return 0;
+#else
+			return sched_setscheduler_nocheck(parm->kthread,
+							  SCHED_FIFO, &param);
+#endif
+		}
+
+		case POLICY_DEADLINE:
+			return sched_setattr_nocheck(parm->kthread, &attr);
+	}
+
+	return 0;
+}
+
+
+/* thread_init_parameter() allocates the per-CPU counters and calls
+ * mutex_init and kthread_create, which allow for mutual exclusion and
+ * create the kernel thread running the building's elevator_service()
+ * function, bound to parm->Cpu unless that is -1 and scheduled under
+ * parm->Policy; the thread is woken once the building is set up.
+ * Returns 0, -ENOMEM or the error from kthread_create() or
+ * service_set_policy()
+ */
+int thread_init_parameter(struct thread_parameter * parm)
+{
+	int ret;
+	int i;
+
+	parm->Current_State = OFFLINE;
+	parm->stop = false;
+	INIT_LIST_HEAD(&parm->list);
+	INIT_LIST_HEAD(&parm->elev);
+
+	for (i = 0; i < 10; i++)
+		INIT_LIST_HEAD(&parm->Floor_Waiting[i]);
+	kref_init(&parm->Ref);
+
+	parm->Counters = alloc_percpu(struct elev_counters);
+	if (parm->Counters == NULL)
+		return -ENOMEM;
+
+	mutex_init(&parm->mutex);
+	init_waitqueue_head(&parm->Run_Wait);
+
+	parm->kthread = kthread_create(elevator_service, parm, "elevator/%s",
+				       parm->Name);
+	if (IS_ERR(parm->kthread))
+	{
+		mutex_destroy(&parm->mutex);
+		free_percpu(parm->Counters);
+		return PTR_ERR(parm->kthread);
+	}
+
+	if (parm->Cpu >= 0)
+		kthread_bind(parm->kthread, parm->Cpu);
+
+	ret = service_set_policy(parm);
+	if (ret != 0)
+	{
+		// never woken, so elevator_service() never runs
+		kthread_stop(parm->kthread);
+		mutex_destroy(&parm->mutex);
+		free_percpu(parm->Counters);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*************************************************************************/
+
+
+/* elevator_proc_open() formats the building's state into a message
+ * buffer for its status file; the buffer lives in the file's
+ * private_data until release, and is sized for every count at its
+ * widest
+ */
+int elevator_proc_open(struct inode *sp_inode, struct file *sp_file)
+{
+	struct thread_parameter * parm = PROC_DATA(sp_inode);
+	char * message;
+	struct elev_counters c;
+	int len = 0;
+	int i;
+
+	message = kmalloc(sizeof(char) * STATUS_ENTRY_SIZE,
+			 __GFP_RECLAIM | __GFP_IO | __GFP_FS);
+
+	if (message == NULL)
+	{
+		pr_warn("elevator: status open failed\n");
+		return -ENOMEM;
+	}
+
+	// one snapshot, so the floors add up with the state and load
+	if (elev_lock(parm, LOCK_PROC_STATUS) != 0)
+	{
+		kfree(message);
+		return -ERESTARTSYS;
+	}
+
+	counters_read(parm, &c, true);
+
+	len += scnprintf(message + len, STATUS_ENTRY_SIZE - len,
+		"State: %s\n", state_names[parm->Current_State]);
+
+	len += scnprintf(message + len, STATUS_ENTRY_SIZE - len,
+		"Current floor: %d\n", parm->Current_Floor);
+
+	len += scnprintf(message + len, STATUS_ENTRY_SIZE - len,
+		"Next floor: %d\n", parm->Next_Floor);
+
+	if (parm->Current_Load.weight_int == 0 &&
+		parm->Current_Load.weight_dec == 0)
+	{
+		len += scnprintf(message + len, STATUS_ENTRY_SIZE - len,
+		"Current load: %d passenger units, 0 weight units\n\n",
+		parm->Current_Load.pass_units);
+	}		
+	else
+	{
+		len += scnprintf(message + len, STATUS_ENTRY_SIZE - len,
+		"Current load: %d passenger units, %d.%d weight units\n\n",
+		parm->Current_Load.pass_units,
+		parm->Current_Load.weight_int,
+		parm->Current_Load.weight_dec);
+	}
+
+	for (i = 0; i < 10; i++)
+	{
+		len += scnprintf(message + len, STATUS_ENTRY_SIZE - len,
+		"Floor %d: %d passengers waiting, %llu passengers serviced\n",
+		i + 1,
+		parm->Waiting_Passengers[i], c.delivered_from[i]);
+	}
+
+	elev_unlock(parm, LOCK_PROC_STATUS);
+
+	sp_file->private_data = message;
+	return 0;
+}
+
+
+/* elevator_proc_read() copies the message formatted at open time
+ * to user space, honouring the read offset
+ */
+ssize_t elevator_proc_read(struct file *sp_file, char __user *buf,
+						   size_t size, loff_t *offset)
+{
+	char * message = sp_file->private_data;
+
+	return simple_read_from_buffer(buf, size, offset, message,
+				       strlen(message));
+}
+
+
+/* elevator_proc_release() frees the message formatted at open time */ 
+int elevator_proc_release(struct inode *sp_inode, struct file *sp_file)
+{
+	kfree(sp_file->private_data);
+	return 0;
+}
+
+
+enum Ctl_Ops { CTL_START, CTL_STOP, CTL_REQ };
+
+struct ctl_cmd
+{
+	enum Ctl_Ops op;
+	Passenger * p;
+};
+
+
+/* elevator_proc_write() drives the building's elevator without the
+ * system calls: the buffer holds newline-separated commands
+ *
+ *     start
+ *     stop
+ *     req <type> <start_floor> <dest_floor>
+ *
+ * (blank lines and lines starting with '#' are skipped). The whole
+ * write is parsed first and refused with -EINVAL if any line is bad;
+ * otherwise every command is applied in order under a single
+ * acquisition of the mutex. Unlike stop_elevator(), "stop" does not
+ * wait for the car to empty
+ */
+ssize_t elevator_proc_write(struct file *sp_file, const char __user *buf,
+							size_t size, loff_t *offset)
+{
+	struct thread_parameter * parm = PROC_DATA(file_inode(sp_file));
+	char * cmds;
+	char * cursor;
+	char * line;
+	struct ctl_cmd * batch;
+	int p_type, src, dst;
+	int count = 1;
+	int n = 0;
+	int i;
+	char extra;
+	ssize_t ret = size;
+
+	if (size > CTL_MAX_WRITE)
+		return -E2BIG;
+
+	cmds = memdup_user_nul(buf, size);
+	if (IS_ERR(cmds))
+		return PTR_ERR(cmds);
+
+	for (cursor = cmds; *cursor; cursor++)
+	{
+		if (*cursor == '\n')
+			count++;
+	}
+
+	batch = kmalloc_array(count, sizeof(*batch), GFP_KERNEL);
+	if (batch == NULL)
+	{
+		kfree(cmds);
+		return -ENOMEM;
+	}
+
+	cursor = cmds;
+	while ((line = strsep(&cursor, "\n")) != NULL)
+	{
+		line = strim(line);
+		if (*line == '\0' || *line == '#')
+			continue;
+
+		batch[n].p = NULL;
+
+		if (strcmp(line, "start") == 0)
+			batch[n].op = CTL_START;
+		else if (strcmp(line, "stop") == 0)
+			batch[n].op = CTL_STOP;
+		else if (sscanf(line, "req %d %d %d %c", &p_type, &src, &dst,
+				&extra) == 3 && valid_request(p_type, src, dst))
+		{
+			batch[n].op = CTL_REQ;
+			batch[n].p = new_passenger(p_type, src, dst);
+			if (batch[n].p == NULL)
+			{
+				ret = -ENOMEM;
+				goto out;
+			}
+		}
+		else
+		{
+			ret = -EINVAL;
+			goto out;
+		}
+
+		n++;
+	}
+
+	if (elev_lock(parm, LOCK_PROC_CTL) != 0)
+	{
+		ret = -ERESTARTSYS;
+		goto out;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		switch (batch[i].op)
+		{
+			case CTL_START:
+				start_locked(parm);
+				break;
+
+			case CTL_STOP:
+				stop_locked(parm);
+				break;
+
+			case CTL_REQ:
+			{
+				// accepted passengers now belong to the elevator
+				if (issue_locked(parm, batch[i].p) == 0)
+					batch[i].p = NULL;
+				break;
+			}
+		}
+	}
+
+	elev_unlock(parm, LOCK_PROC_CTL);
+
+	wake_up(&parm->Run_Wait);
+
+out:
+	// refused requests and everything after a parse error
+	for (i = 0; i < n; i++)
+		kfree(batch[i].p);
+
+	kfree(batch);
+	kfree(cmds);
+	return ret;
+}
+
+
+/*************************************************************************/
+
+
+/* States as they appear in stats keys */
+static const char * stats_state_names[NUM_STATES] =
+{
+	"offline", "idle", "loading", "up", "down"
+};
+
+
+/* elevator_stats_proc_open() takes a consistent snapshot of the
+ * measurement counters (under the mutex) and formats it as
+ * "key: value" lines for the building's stats file; durations are in ms
+ */
+int elevator_stats_proc_open(struct inode *sp_inode, struct file *sp_file)
+{
+	struct thread_parameter * parm = PROC_DATA(sp_inode);
+	char * stats_message;
+	struct list_head * temp;
+	struct elev_counters c;
+	Passenger * oldest;
+	u64 oldest_ns = 0;
+	u64 now;
+	u64 online_ns = 0;
+	u64 capacity_ns;
+	u64 permille = 0;
+	u64 floors_per_delivery = 0;
+	u64 wakeups = 0;
+	int waiting = 0;
+	int riding = 0;
+	int groups = 0;
+	int len = 0;
+	int i;
+
+	stats_message = kmalloc(sizeof(char) * STATS_ENTRY_SIZE,
+			 __GFP_RECLAIM | __GFP_IO | __GFP_FS);
+
+	if (stats_message == NULL)
+	{
+		pr_warn("elevator: stats open failed\n");
+		return -ENOMEM;
+	}
 
-				if (mutex_lock_interruptible(&parm->mutex) == 0)
-				{
-					parm->Current_State = LOADING;	
-				}
-				mutex_unlock(&elevator.mutex);
-			}
+	if (elev_lock(parm, LOCK_PROC_STATS) != 0)
+	{
+		kfree(stats_message);
+		return -ERESTARTSYS;
+	}
 
-			else // (parm->Current_State == DOWN)
-			{
-				while (parm->Current_Floor != parm->Next_Floor)
-				{
-					ssleep(2);
-					
-					if (mutex_lock_interruptible(&parm->mutex) == 0)
-					{
-						parm->Current_Floor--;
-					}
-					mutex_unlock(&elevator.mutex);
-				}
+	now = ktime_get_ns();
 
-				if (mutex_lock_interruptible(&parm->mutex) == 0)
-				{
-					parm->Current_State = LOADING;	
-				}
-				mutex_unlock(&elevator.mutex);	
-			}
-		}
+	if (parm->Current_State != OFFLINE)
+	{
+		stats_account_load(parm);
+		online_ns = now - parm->Stats.online_since;
 	}
-		
+
+	counters_read(parm, &c, true);
+
+	for (i = 0; i < 10; i++)
+		waiting += parm->Waiting_Passengers[i];
+
+	list_for_each(temp, &parm->elev)
+		riding += list_entry(temp, Passenger, list)->count;
+
+	list_for_each(temp, &parm->list)
+		groups++;
+
+	capacity_ns = online_ns * MAX_PASSENGER_UNITS;
+	if (capacity_ns > 0)
+		permille = div64_u64(parm->Stats.load_ns * 1000, capacity_ns);
+
+	if (c.delivered > 0)
+		floors_per_delivery = div64_u64(c.floors_moved * 1000, c.delivered);
+
+	len += scnprintf(stats_message + len, STATS_ENTRY_SIZE - len,
+		"handle: %d\n"
+		"offline: %d\n"
+		"online_ms: %llu\n"
+		"issued: %llu\n"
+		"rejected: %llu\n"
+		"waiting: %d\n"
+		"waiting_groups: %d\n"
+		"riding: %d\n"
+		"boarded: %llu\n"
+		"delivered: %llu\n"
+		"dropped: %llu\n",
+		parm->id, parm->Current_State == OFFLINE,
+		div_u64(online_ns, NSEC_PER_MSEC),
+		c.issued, c.rejected,
+		waiting, groups, riding,
+		c.boarded, c.delivered,
+		c.dropped);
+
+	len += scnprintf(stats_message + len, STATS_ENTRY_SIZE - len,
+		"wait_total_ms: %llu\n"
+		"wait_p50_ms: %llu\n"
+		"wait_p99_ms: %llu\n"
+		"ride_total_ms: %llu\n"
+		"ride_p50_ms: %llu\n"
+		"ride_p99_ms: %llu\n",
+		div_u64(parm->Stats.wait_ns, NSEC_PER_MSEC),
+		stats_hist_percentile(parm->Stats.wait_hist, 50),
+		stats_hist_percentile(parm->Stats.wait_hist, 99),
+		div_u64(parm->Stats.ride_ns, NSEC_PER_MSEC),
+		stats_hist_percentile(parm->Stats.ride_hist, 50),
+		stats_hist_percentile(parm->Stats.ride_hist, 99));
+
+	len += scnprintf(stats_message + len, STATS_ENTRY_SIZE - len,
+		"busy_ms: %llu\n"
+		"load_unit_ms: %llu\n"
+		"capacity_units: %d\n"
+		"utilization_permille: %llu\n",
+		div_u64(parm->Stats.busy_ns, NSEC_PER_MSEC),
+		div_u64(parm->Stats.load_ns, NSEC_PER_MSEC),
+		MAX_PASSENGER_UNITS, permille);
+
+	len += scnprintf(stats_message + len, STATS_ENTRY_SIZE - len,
+		"stops: %llu\n"
+		"dwell_total_ms: %llu\n"
+		"dwell_saved_ms: %lld\n",
+		c.stops,
+		div_u64(c.dwell_ns, NSEC_PER_MSEC),
+		div_s64(c.dwell_saved_ns, NSEC_PER_MSEC));
+
+	len += scnprintf(stats_message + len, STATS_ENTRY_SIZE - len,
+		"runs: %llu\n"
+		"replans: %llu\n"
+		"run_total_ms: %llu\n"
+		"floors_moved: %llu\n"
+		"floors_per_delivery_milli: %llu\n"
+		"idle_ms: %llu\n",
+		c.runs, c.replans,
+		div_u64(c.run_ns, NSEC_PER_MSEC),
+		c.floors_moved, floors_per_delivery,
+		div_u64(c.state_ns[IDLE], NSEC_PER_MSEC));
+
+	len += scnprintf(stats_message + len, STATS_ENTRY_SIZE - len,
+		"floors_loaded: %llu\n"
+		"floors_empty: %llu\n"
+		"starts: %llu\n"
+		"door_cycles: %llu\n"
+		"energy_mj: %llu\n"
+		"energy_per_delivery_mj: %llu\n",
+		c.floors_loaded, c.floors_moved - c.floors_loaded,
+		c.starts, c.door_cycles, energy_mj(&c),
+		c.delivered > 0 ? div64_u64(energy_mj(&c), c.delivered) : 0);
+
+	for (i = 0; i < NUM_STATES; i++)
+	{
+		len += scnprintf(stats_message + len, STATS_ENTRY_SIZE - len,
+			"state_%s_ms: %llu\n", stats_state_names[i],
+			div_u64(c.state_ns[i], NSEC_PER_MSEC));
+	}
+
+	for (i = 0; i < JITTER_BUCKETS; i++)
+		wakeups += c.jitter_hist[i];
+
+	len += scnprintf(stats_message + len, STATS_ENTRY_SIZE - len,
+		"wakeups: %llu\n"
+		"wakeup_late_mean_us: %llu\n"
+		"wakeup_late_p99_us: %llu\n",
+		wakeups,
+		wakeups > 0 ? div64_u64(c.jitter_ns, wakeups * NSEC_PER_USEC) : 0,
+		jitter_percentile(&c, 99));
+
+	len += scnprintf(stats_message + len, STATS_ENTRY_SIZE - len,
+		"events: %llu\n"
+		"events_dropped: %llu\n"
+		"invariant_violations: %llu\n",
+		c.events, c.events_dropped, c.invariant_violations);
+
+	// the waiting list is in issue order, so its head is the oldest
+	if (!list_empty(&parm->list))
+	{
+		oldest = list_entry(parm->list.next, Passenger, list);
+		oldest_ns = now - oldest->issued_ns;
+	}
+
+	len += scnprintf(stats_message + len, STATS_ENTRY_SIZE - len,
+		"max_wait_ms: %u\n"
+		"starved_runs: %llu\n"
+		"oldest_wait_ms: %llu\n"
+		"fairness_permille: %llu\n",
+		READ_ONCE(max_wait_ms), c.starved_runs,
+		div_u64(oldest_ns, NSEC_PER_MSEC),
+		stats_fairness_permille(parm));
+
+	elev_unlock(parm, LOCK_PROC_STATS);
+
+	sp_file->private_data = stats_message;
 	return 0;
 }
 
 
-/* thread_init_parameter() calls mutex_init and kthread_run,
- * which allow for mutual exclusion and start a running
- * kernel thread (which will be used for the mutual exclusion
- * as well as the elevator_service() function), respectively
+/* elevator_stats_proc_read() copies the snapshot taken at open
+ * time to user space, honouring the read offset
  */
-void thread_init_parameter(struct thread_parameter * parm)
+ssize_t elevator_stats_proc_read(struct file *sp_file, char __user *buf,
+								 size_t size, loff_t *offset)
 {
-	parm->Current_State = OFFLINE;
+	char * stats_message = sp_file->private_data;
+
+	return simple_read_from_buffer(buf, size, offset, stats_message,
+				       strlen(stats_message));
+}
 
-	mutex_init(&parm->mutex);
 
-	parm->kthread = kthread_run(elevator_service, parm,
-				    "elevator in service");	
+/* elevator_stats_proc_release() frees the snapshot */
+int elevator_stats_proc_release(struct inode *sp_inode, struct file *sp_file)
+{
+	kfree(sp_file->private_data);
+	return 0;
 }
 
-/*************************************************************************/
 
+/* elevator_locks_proc_open() formats the per-site lock profile for
+ * the building's locks file, one line per site; all times are in ns
+ * and cumulative since the building was created
+ */
+int elevator_locks_proc_open(struct inode *sp_inode, struct file *sp_file)
+{
+	struct thread_parameter * parm = PROC_DATA(sp_inode);
+	char * locks_message;
+	int len = 0;
+	int i;
+
+	locks_message = kmalloc(sizeof(char) * LOCKS_ENTRY_SIZE,
+			 __GFP_RECLAIM | __GFP_IO | __GFP_FS);
+
+	if (locks_message == NULL)
+	{
+		pr_warn("elevator: locks open failed\n");
+		return -ENOMEM;
+	}
+
+	if (elev_lock(parm, LOCK_PROC_LOCKS) != 0)
+	{
+		kfree(locks_message);
+		return -ERESTARTSYS;
+	}
+
+	len += scnprintf(locks_message + len, LOCKS_ENTRY_SIZE - len,
+		"site acquired interrupted wait_ns wait_max_ns "
+		"hold_ns hold_max_ns\n");
 
-/* elevator_proc_open() modifies the message variable so that it
- * contains the necessary information to be printed to the
- * /proc/elevator entry 
+	for (i = 0; i < NUM_LOCK_SITES; i++)
+	{
+		len += scnprintf(locks_message + len, LOCKS_ENTRY_SIZE - len,
+			"%s %llu %lld %llu %llu %llu %llu\n",
+			lock_site_names[i],
+			parm->Lock_Sites[i].acquired,
+			(long long)atomic64_read(&parm->Lock_Sites[i].interrupted),
+			parm->Lock_Sites[i].wait_ns,
+			parm->Lock_Sites[i].wait_max_ns,
+			parm->Lock_Sites[i].hold_ns,
+			parm->Lock_Sites[i].hold_max_ns);
+	}
+
+	elev_unlock(parm, LOCK_PROC_LOCKS);
+
+	sp_file->private_data = locks_message;
+	return 0;
+}
+
+
+/* elevator_floors_proc_open() formats the building's floors file, one
+ * line per floor: passengers waiting there now and how long the
+ * oldest of them has waited, and the pickups since the elevator was
+ * started with their mean and longest wait; times are in ms
  */
-int elevator_proc_open(struct inode *sp_inode, struct file *sp_file)
+int elevator_floors_proc_open(struct inode *sp_inode, struct file *sp_file)
 {
-	char * buf = kmalloc (sizeof(char) * 100, __GFP_RECLAIM);	
+	struct thread_parameter * parm = PROC_DATA(sp_inode);
+	Passenger * p;
+	char * floors_message;
+	u64 oldest_ns[10] = { 0 };
+	u64 served;
+	u64 now;
+	int len = 0;
 	int i;
 
-	if (buf == NULL)
+	floors_message = kmalloc(sizeof(char) * FLOORS_ENTRY_SIZE,
+			 __GFP_RECLAIM | __GFP_IO | __GFP_FS);
+
+	if (floors_message == NULL)
 	{
-		printk(KERN_WARNING "print_time");
+		pr_warn("elevator: floors open failed\n");
 		return -ENOMEM;
 	}
 
-	printk(KERN_INFO "proc called open\n");
-	printk(KERN_NOTICE "PROC_OPEN FUNCTION ENTERED\n");
-	
-	read_p = 1;
-	message = kmalloc(sizeof(char) * ENTRY_SIZE,
+	if (elev_lock(parm, LOCK_PROC_FLOORS) != 0)
+	{
+		kfree(floors_message);
+		return -ERESTARTSYS;
+	}
+
+	now = ktime_get_ns();
+
+	// each floor's queue is in issue order, so its head is the oldest
+	for (i = 0; i < 10; i++)
+	{
+		p = list_first_entry_or_null(&parm->Floor_Waiting[i],
+					     Passenger, floor);
+		if (p != NULL)
+			oldest_ns[i] = now - p->issued_ns;
+	}
+
+	len += scnprintf(floors_message + len, FLOORS_ENTRY_SIZE - len,
+		"floor waiting oldest_ms served wait_mean_ms wait_max_ms\n");
+
+	for (i = 0; i < 10; i++)
+	{
+		served = parm->Stats.floor_served[i];
+
+		len += scnprintf(floors_message + len, FLOORS_ENTRY_SIZE - len,
+			"%d %d %llu %llu %llu %llu\n", i + 1,
+			parm->Waiting_Passengers[i],
+			div_u64(oldest_ns[i], NSEC_PER_MSEC), served,
+			served == 0 ? 0 : div64_u64(parm->Stats.floor_wait_ns[i],
+						    served * NSEC_PER_MSEC),
+			div_u64(parm->Stats.floor_wait_max_ns[i], NSEC_PER_MSEC));
+	}
+
+	elev_unlock(parm, LOCK_PROC_FLOORS);
+
+	sp_file->private_data = floors_message;
+	return 0;
+}
+
+
+/* elevator_jitter_proc_open() formats the building's jitter file: the
+ * histogram of how late the service thread's timed wakeups came since
+ * the elevator was started, one line per bucket of [lo_us, hi_us);
+ * the last bucket is open-ended (hi_us -1)
+ */
+int elevator_jitter_proc_open(struct inode *sp_inode, struct file *sp_file)
+{
+	struct thread_parameter * parm = PROC_DATA(sp_inode);
+	struct elev_counters c;
+	char * jitter_message;
+	int len = 0;
+	int i;
+
+	jitter_message = kmalloc(sizeof(char) * JITTER_ENTRY_SIZE,
 			 __GFP_RECLAIM | __GFP_IO | __GFP_FS);
 
-	if (message == NULL)
+	if (jitter_message == NULL)
 	{
-		printk(KERN_WARNING "time_proc_open");
+		pr_warn("elevator: jitter open failed\n");
 		return -ENOMEM;
 	}
 
-	strcpy(message, "");
-	switch (elevator.Current_State)
+	if (elev_lock(parm, LOCK_PROC_JITTER) != 0)
 	{
-		case 0:
-		{
-			sprintf(buf, "State: OFFLINE\n");
-			break;
-		}
-		
-		case 1:
-		{
-			sprintf(buf, "State: IDLE\n");
-			break;
-		}
+		kfree(jitter_message);
+		return -ERESTARTSYS;
+	}
 
-		case 2:
-		{
-			sprintf(buf, "State: LOADING\n");
-			break;
-		}
-	
-		case 3:
-		{
-			sprintf(buf, "State: UP\n");
-			break;
-		}
-	
-		case 4:
-		{
-			sprintf(buf, "State: DOWN\n");
-			break;
-		}
-	
-		strcat(message, buf);	
-	
-		sprintf(buf, "Current floor: %d\n", elevator.Current_Floor);
-		strcat(message, buf);
+	counters_read(parm, &c, true);
+
+	elev_unlock(parm, LOCK_PROC_JITTER);
+
+	len += scnprintf(jitter_message + len, JITTER_ENTRY_SIZE - len,
+		"lo_us hi_us wakeups\n");
+
+	for (i = 0; i < JITTER_BUCKETS; i++)
+	{
+		len += scnprintf(jitter_message + len, JITTER_ENTRY_SIZE - len,
+			"%llu %lld %llu\n", i == 0 ? 0 : 1ULL << (i - 1),
+			i == JITTER_BUCKETS - 1 ? -1LL : (long long)(1ULL << i),
+			c.jitter_hist[i]);
 	}
 
-	sprintf(buf, "Next floor: %d\n", elevator.Next_Floor);
-	strcat(message, buf);
+	sp_file->private_data = jitter_message;
+	return 0;
+}
+
+
+/* elevator_eta_proc_open() formats the building's eta file: for every
+ * floor, the ms until the car can pick up a call going up and one
+ * going down made now, or -1 while the elevator takes no requests
+ */
+int elevator_eta_proc_open(struct inode *sp_inode, struct file *sp_file)
+{
+	struct thread_parameter * parm = PROC_DATA(sp_inode);
+	char * eta_message;
+	int len = 0;
+	int f;
+
+	eta_message = kmalloc(sizeof(char) * ETA_ENTRY_SIZE,
+			 __GFP_RECLAIM | __GFP_IO | __GFP_FS);
 
-	if (elevator.Current_Load.weight_int == 0 &&
-		elevator.Current_Load.weight_dec == 0)
+	if (eta_message == NULL)
 	{
-		sprintf(buf,
-		"Current load: %d passenger units, 0 weight units\n\n",
-		elevator.Current_Load.pass_units);
-	}		
-	else
+		pr_warn("elevator: eta open failed\n");
+		return -ENOMEM;
+	}
+
+	if (elev_lock(parm, LOCK_PROC_ETA) != 0)
 	{
-		sprintf(buf,
-		"Current load: %d passenger units, %d.%d weight units\n\n",
-		elevator.Current_Load.pass_units,
-		elevator.Current_Load.weight_int,
-		elevator.Current_Load.weight_dec);
+		kfree(eta_message);
+		return -ERESTARTSYS;
 	}
 
-	strcat(message, buf);
+	len += scnprintf(eta_message + len, ETA_ENTRY_SIZE - len,
+		"floor up_ms down_ms\n");
 
-	for (i = 0; i < 10; i++)
+	for (f = 1; f <= 10; f++)
 	{
-		sprintf(buf,
-		"Floor %d: %d passengers waiting, %d passengers serviced\n",
-		i + 1,
-		elevator.Waiting_Passengers[i], elevator.Total_Passengers[i]);
-		strcat(message, buf);
+		len += scnprintf(eta_message + len, ETA_ENTRY_SIZE - len,
+			"%d %ld %ld\n", f,
+			eta_remaining(parm, ETA_UP, f),
+			eta_remaining(parm, ETA_DOWN, f));
 	}
 
+	elev_unlock(parm, LOCK_PROC_ETA);
+
+	sp_file->private_data = eta_message;
 	return 0;
 }
 
 
-/* elevator_proc_read() copies the contents of message
- * to the /proc/elevator entry 
+/*************************************************************************/
+
+
+
+
+/* valid_building_name() accepts names that make a sane directory
+ * under /proc/elevator: letters, digits, '-' and '_'
  */
-ssize_t elevator_proc_read(struct file *sp_file, char __user *buf,
-						   size_t size, loff_t *offset)
+bool valid_building_name(const char * name)
 {
-	int len = strlen(message);
-	
-	read_p = !read_p;
-	if (read_p)
-		return 0;
+	int len = strlen(name);
+	int i;
 
-	printk(KERN_INFO "proc called read\n");
+	if (len == 0 || len >= BUILDING_NAME_LEN ||
+		strcmp(name, BUILDINGS_ENTRY_NAME) == 0)
+		return false;
 
-	copy_to_user(buf, message, len);
-	return len;
+	for (i = 0; i < len; i++)
+	{
+		if (!isalnum(name[i]) && name[i] != '-' && name[i] != '_')
+			return false;
+	}
+
+	return true;
 }
 
 
-/* elevator_proc_release() frees the data that was in the message
- * variable and releases the /proc/elevator entry 
- */ 
-int elevator_proc_release(struct inode *sp_inode, struct file *sp_file)
+/* find_building_locked() returns the building called name, or NULL
+ * if there is none; must be called with buildings_mutex held
+ */
+struct thread_parameter * find_building_locked(const char * name)
+{
+	struct thread_parameter * parm;
+	int id;
+
+	idr_for_each_entry(&buildings, parm, id)
+	{
+		if (strcmp(parm->Name, name) == 0)
+			return parm;
+	}
+
+	return NULL;
+}
+
+
+/* create_building() sets up a building called name, with its /proc
+ * directory and a service thread bound to cpu (or free to run
+ * anywhere if cpu is -1) and scheduled under policy; returns the new
+ * building's handle or a negative error. Must be called with
+ * buildings_mutex held
+ */
+int create_building(const char * name, int cpu, int policy)
+{
+	struct thread_parameter * parm;
+	struct proc_dir_entry * dir;
+	int ret;
+
+	if (!valid_building_name(name))
+		return -EINVAL;
+
+	if (cpu < -1 || cpu >= (int)nr_cpu_ids || (cpu >= 0 && !cpu_online(cpu)))
+		return -EINVAL;
+
+	if (find_building_locked(name) != NULL)
+		return -EEXIST;
+
+	parm = kzalloc(sizeof(*parm), GFP_KERNEL);
+	if (parm == NULL)
+		return -ENOMEM;
+
+	strscpy(parm->Name, name, BUILDING_NAME_LEN);
+	parm->Cpu = cpu;
+	parm->Policy = policy;
+	parm->id = -1;
+
+	ret = thread_init_parameter(parm);
+	if (ret != 0)
+	{
+		kfree(parm);
+		return ret;
+	}
+
+	ret = -ENOMEM;
+
+	dir = proc_mkdir(name, elevator_dir);
+	if (dir == NULL)
+		goto fail;
+
+	if (!proc_create_data(STATUS_ENTRY_NAME, PERMS, dir, &fops, parm) ||
+		!proc_create_data(STATS_ENTRY_NAME, PERMS, dir, &stats_fops, parm) ||
+		!proc_create_data(LOCKS_ENTRY_NAME, PERMS, dir, &locks_fops, parm) ||
+		!proc_create_data(ETA_ENTRY_NAME, PERMS, dir, &eta_fops, parm) ||
+		!proc_create_data(FLOORS_ENTRY_NAME, PERMS, dir, &floors_fops, parm) ||
+		!proc_create_data(JITTER_ENTRY_NAME, PERMS, dir, &jitter_fops, parm))
+		goto fail;
+
+	// published last, so system calls only ever find a complete
+	// building
+	ret = idr_alloc(&buildings, parm, 0, 0, GFP_KERNEL);
+	if (ret < 0)
+		goto fail;
+
+	parm->id = ret;
+	parm->Proc_Dir = dir;
+	wake_up_process(parm->kthread);
+
+	printk(KERN_NOTICE "/proc/%s/%s create\n", ENTRY_NAME, name);
+	return parm->id;
+
+fail:
+	// waits out anyone who opened the files in the meantime
+	proc_remove(dir);
+	kthread_stop(parm->kthread);
+	building_put(parm);
+	return ret;
+}
+
+
+/* destroy_building() unpublishes a building, removes its /proc
+ * directory and stops its service thread, then takes it OFFLINE for
+ * good, dropping everyone still waiting; it is freed once system
+ * calls still holding a reference are done with it. Must be called
+ * with buildings_mutex held
+ */
+void destroy_building(struct thread_parameter * parm)
+{
+	idr_remove(&buildings, parm->id);
+
+	// waits for readers and writers of the building's files
+	proc_remove(parm->Proc_Dir);
+	kthread_stop(parm->kthread);
+
+	// system calls that found the building before idr_remove() see
+	// it OFFLINE and refusing requests; it is gone, so it is not
+	// profiled
+	mutex_lock(&parm->mutex);
+	parm->Removed = true;
+	parm->stop = true;
+	go_offline(parm);
+	mutex_unlock(&parm->mutex);
+
+	printk(KERN_NOTICE "Removing /proc/%s/%s\n", ENTRY_NAME, parm->Name);
+	building_put(parm);
+}
+
+
+/* parse_policy() returns the enum Service_Policies called name, or
+ * -EINVAL
+ */
+int parse_policy(const char * name)
 {
-	printk(KERN_NOTICE "proc called release\n");
-	kfree(message);
+	int i;
+
+	for (i = 0; i < NUM_POLICIES; i++)
+	{
+		if (sysfs_streq(name, policy_names[i]))
+			return i;
+	}
+
+	return -EINVAL;
+}
+
+
+/* buildings_proc_open() lists the buildings for
+ * /proc/elevator/buildings, one "handle name cpu state" line each;
+ * the handle is what the system calls take
+ */
+int buildings_proc_open(struct inode *sp_inode, struct file *sp_file)
+{
+	struct thread_parameter * parm;
+	char * buildings_message;
+	int len = 0;
+	int id;
+
+	buildings_message = kmalloc(sizeof(char) * BUILDINGS_ENTRY_SIZE,
+			 __GFP_RECLAIM | __GFP_IO | __GFP_FS);
+
+	if (buildings_message == NULL)
+	{
+		pr_warn("elevator: buildings open failed\n");
+		return -ENOMEM;
+	}
+
+	if (mutex_lock_interruptible(&buildings_mutex) != 0)
+	{
+		kfree(buildings_message);
+		return -ERESTARTSYS;
+	}
+
+	len += scnprintf(buildings_message + len, BUILDINGS_ENTRY_SIZE - len,
+		"handle name cpu state policy\n");
+
+	idr_for_each_entry(&buildings, parm, id)
+	{
+		len += scnprintf(buildings_message + len,
+			BUILDINGS_ENTRY_SIZE - len, "%d %s %d %s %s\n", id,
+			parm->Name, parm->Cpu,
+			state_names[READ_ONCE(parm->Current_State)],
+			policy_names[parm->Policy]);
+	}
+
+	mutex_unlock(&buildings_mutex);
+
+	sp_file->private_data = buildings_message;
 	return 0;
 }
 
 
+/* buildings_proc_write() takes one command per write:
+ *
+ *     create <name> [cpu [policy]]
+ *     destroy <name>
+ *
+ * create pins the new building's service thread to cpu if one other
+ * than -1 is given, and runs it under policy (normal, fifo or
+ * deadline); destroy drops everyone still in the building
+ */
+ssize_t buildings_proc_write(struct file *sp_file, const char __user *buf,
+							 size_t size, loff_t *offset)
+{
+	struct thread_parameter * parm;
+	char * cmd;
+	char * args;
+	char * verb;
+	char * name;
+	char * cpu_arg;
+	int cpu = -1;
+	int policy = POLICY_NORMAL;
+	int id;
+	ssize_t ret = size;
+
+	if (size > CTL_MAX_WRITE)
+		return -E2BIG;
+
+	cmd = memdup_user_nul(buf, size);
+	if (IS_ERR(cmd))
+		return PTR_ERR(cmd);
+
+	args = strim(cmd);
+	verb = strsep(&args, " ");
+	name = strsep(&args, " ");
+
+	if (name == NULL)
+	{
+		kfree(cmd);
+		return -EINVAL;
+	}
+
+	if (mutex_lock_interruptible(&buildings_mutex) != 0)
+	{
+		kfree(cmd);
+		return -ERESTARTSYS;
+	}
+
+	if (strcmp(verb, "create") == 0)
+	{
+		cpu_arg = strsep(&args, " ");
+
+		if (cpu_arg != NULL && kstrtoint(cpu_arg, 0, &cpu) != 0)
+			ret = -EINVAL;
+		else if (args != NULL && (policy = parse_policy(args)) < 0)
+			ret = policy;
+		else if ((id = create_building(name, cpu, policy)) < 0)
+			ret = id;
+	}
+	else if (strcmp(verb, "destroy") == 0 && args == NULL)
+	{
+		parm = find_building_locked(name);
+		if (parm == NULL)
+			ret = -ENOENT;
+		else
+			destroy_building(parm);
+	}
+	else
+	{
+		ret = -EINVAL;
+	}
+
+	mutex_unlock(&buildings_mutex);
+
+	kfree(cmd);
+	return ret;
+}
+
+
 /*************************************************************************/
 
 
-/* elevator_init() maps the system call stubs to their respective
- * definition functions, creates the /proc/elevator file, sets
- * fops.open, fops.read, and fops.release, and calls
- * thread_init_parameter() to start the kthread which will be used
- * for the elevator_service() function and mutual exclusion
+#ifdef ELEVATOR_SYSCALLS
+/* the system call implementations handed to the built-in stubs */
+static const struct elevator_ops syscall_ops =
+{
+	.owner = THIS_MODULE,
+	.start_elevator = my_start_elevator,
+	.issue_request = my_issue_request,
+	.stop_elevator = my_stop_elevator,
+	.elevator_eta = my_elevator_eta,
+};
+#endif
+
+
+/* elevator_init() registers the event netlink family, creates the
+ * /proc/elevator directory and its buildings file, sets the
+ * operations of the per-building files, creates the default building
+ * (handle 0) with create_building(), and (when built with
+ * ELEVATOR_SYSCALLS) registers the system call implementations with
+ * the built-in stubs
  */
 static int elevator_init(void)
 {
 	// all initialization code
 
-	stop = false;
-	STUB_start_elevator = my_start_elevator;
-	STUB_issue_request = my_issue_request;
-	STUB_stop_elevator = my_stop_elevator;
+	int ret;
 
 	printk(KERN_NOTICE "/proc/%s create\n", ENTRY_NAME);
 
-	fops.open = elevator_proc_open;
-	fops.read = elevator_proc_read;
-	fops.release = elevator_proc_release;
-		
-	if (!proc_create(ENTRY_NAME, PERMS, NULL, &fops))
+	SET_PROC_FOPS(fops, elevator_proc_open, elevator_proc_read,
+		      elevator_proc_write, elevator_proc_release);
+
+	SET_PROC_FOPS(stats_fops, elevator_stats_proc_open,
+		      elevator_stats_proc_read, NULL,
+		      elevator_stats_proc_release);
+
+	// the snapshot read and release work for the stats, locks, eta,
+	// floors, jitter and buildings files
+	SET_PROC_FOPS(locks_fops, elevator_locks_proc_open,
+		      elevator_stats_proc_read, NULL,
+		      elevator_stats_proc_release);
+
+	SET_PROC_FOPS(eta_fops, elevator_eta_proc_open,
+		      elevator_stats_proc_read, NULL,
+		      elevator_stats_proc_release);
+
+	SET_PROC_FOPS(floors_fops, elevator_floors_proc_open,
+		      elevator_stats_proc_read, NULL,
+		      elevator_stats_proc_release);
+
+	SET_PROC_FOPS(jitter_fops, elevator_jitter_proc_open,
+		      elevator_stats_proc_read, NULL,
+		      elevator_stats_proc_release);
+
+	SET_PROC_FOPS(buildings_fops, buildings_proc_open,
+		      elevator_stats_proc_read, buildings_proc_write,
+		      elevator_stats_proc_release);
+
+	ret = genl_register_family(&elev_genl_family);
+	if (ret != 0)
+	{
+		printk(KERN_WARNING "genl_register_family\n");
+		return ret;
+	}
+
+	elevator_dir = proc_mkdir(ENTRY_NAME, PARENT);
+	if (elevator_dir == NULL)
+	{
+		printk(KERN_WARNING "proc create\n");
+		genl_unregister_family(&elev_genl_family);
+		return -ENOMEM;
+	}
+
+	if (!proc_create(BUILDINGS_ENTRY_NAME, PERMS, elevator_dir,
+			 &buildings_fops))
 	{
 		printk(KERN_WARNING "proc create\n");
-		remove_proc_entry(ENTRY_NAME, NULL);
+		proc_remove(elevator_dir);
+		genl_unregister_family(&elev_genl_family);
 		return -ENOMEM;
 	}
 
-	thread_init_parameter(&elevator);
-	if (IS_ERR(elevator.kthread))
+	ret = parse_policy(default_policy);
+	if (ret >= 0)
+	{
+		mutex_lock(&buildings_mutex);
+		ret = create_building(DEFAULT_BUILDING, default_cpu, ret);
+		mutex_unlock(&buildings_mutex);
+	}
+
+	if (ret < 0)
 	{
-		printk(KERN_WARNING "error spawning thread");
-		remove_proc_entry(ENTRY_NAME, NULL);
-		return PTR_ERR(elevator.kthread);
+		pr_warn("elevator: creating the default building failed\n");
+		proc_remove(elevator_dir);
+		genl_unregister_family(&elev_genl_family);
+		return ret;
 	}
 
+#ifdef ELEVATOR_SYSCALLS
+	// registered last: nothing may fail once callers can get in
+	if (elevator_register_ops(&syscall_ops) != 0)
+		printk(KERN_WARNING "elevator system calls already taken\n");
+#endif
+
 	return 0;
 }
 module_init(elevator_init);
 
 
-/* elevator_exit() stops the kthread, removes the /proc/elevator
- * entry, maps the system call stubs to the NULL pointer, and
- * calls mutex_destroy()
+/* elevator_exit() unregisters the system call implementations
+ * (waiting out callers still inside them), destroys every building
+ * with destroy_building(), removes the /proc/elevator directory and
+ * unregisters the event netlink family
  */ 
 static void elevator_exit(void)
 {
 	// all clean up code
+
+	struct thread_parameter * parm;
+	int id;
 	
-	STUB_start_elevator = NULL;
-	STUB_issue_request = NULL;
-	STUB_stop_elevator = NULL;
+#ifdef ELEVATOR_SYSCALLS
+	elevator_unregister_ops(&syscall_ops);
+#endif
+
+	mutex_lock(&buildings_mutex);
+
+	idr_for_each_entry(&buildings, parm, id)
+		destroy_building(parm);
+
+	mutex_unlock(&buildings_mutex);
 
-	kthread_stop(elevator.kthread);
-	remove_proc_entry(ENTRY_NAME, NULL);
-	mutex_destroy(&elevator.mutex);
+	idr_destroy(&buildings);
+	proc_remove(elevator_dir);
+	genl_unregister_family(&elev_genl_family);
 	printk(KERN_NOTICE "Removing /proc/%s\n", ENTRY_NAME);
 }
 module_exit(elevator_exit);
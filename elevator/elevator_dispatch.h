@@ -0,0 +1,707 @@
+#ifndef ELEVATOR_DISPATCH_H
+#define ELEVATOR_DISPATCH_H
+
+/* The dispatch core of the elevator module: how it holds waiting
+ * passengers, and the decisions it makes from them, as functions of
+ * their arguments alone. Identical trips travel as one group node,
+ * queued on the floor they wait on, and a trip table with a
+ * destination mask per floor answers the next-stop scans without
+ * walking any list.
+ *
+ * Nothing here touches a building, a lock or a module parameter, so
+ * elevator_test.c can run it over made-up passengers. The part above
+ * __KERNEL__ is also shared with bench/passenger_scan.c, so outside
+ * the kernel it brings its own list head and integer types.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#else
+#include <stdint.h>
+
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+struct list_head
+{
+	struct list_head * next;
+	struct list_head * prev;
+};
+#endif
+
+#define MAX_PASSENGER_UNITS 10
+#define MAX_WEIGHT_INT 15
+#define MAX_WEIGHT_DEC 0
+
+/* pending calls and ETAs are indexed by direction */
+#define ETA_UP 0
+#define ETA_DOWN 1
+
+/* what the car carries; the weight is weight_int.weight_dec, and
+ * only ever a whole or a half
+ */
+struct car_load
+{
+	int pass_units;
+	int weight_int;
+	int weight_dec;
+};
+
+/* one node stands for count passengers of the same type making the
+ * same trip; pass_units and the weight are per passenger. Waiting
+ * requests for a trip already waiting join its group, and a group is
+ * only split when the car cannot take all of it
+ */
+typedef struct
+{
+	int src;
+	int dst;
+	int p_type;
+	int count;
+	int pass_units;
+	int weight_int;
+	int weight_dec;
+	u64 issued_ns;		// when the oldest member was issued
+	u64 issued_spread_ns;	// sum of the others' issue times after it
+	u64 boarded_ns;
+	struct list_head list;	// on the waiting list or the car's
+	struct list_head floor;	// on its floor's queue while waiting
+} Passenger;
+
+/* passengers waiting by (src, dst), and per source floor a mask with
+ * bit dst - 1 set while any of them wait for dst
+ */
+struct trip_table
+{
+	int count[10][10];
+	u16 dst_mask[10];
+};
+
+
+/* trip_count() adds n (negative to take away) passengers waiting on
+ * floor src for floor dst to t, keeping the destination masks in step
+ */
+static inline void trip_count(struct trip_table * t, int src, int dst, int n)
+{
+	int * trips = &t->count[src - 1][dst - 1];
+
+	*trips += n;
+
+	if (*trips > 0)
+		t->dst_mask[src - 1] |= 1 << (dst - 1);
+	else
+		t->dst_mask[src - 1] &= ~(1 << (dst - 1));
+}
+
+
+/* nearest_call_up() returns the nearest floor in (from, limit] where
+ * someone waits to go above from, or -1 if there is none; one mask
+ * test per floor, so it does not depend on how many are waiting
+ */
+static inline int nearest_call_up(const struct trip_table * t, int from,
+				  int limit)
+{
+	int floor;
+
+	if (limit > 10)
+		limit = 10;
+
+	for (floor = from + 1; floor <= limit; floor++)
+	{
+		if (t->dst_mask[floor - 1] >> from)
+			return floor;
+	}
+
+	return -1;
+}
+
+
+/* nearest_call_down() returns the nearest floor in [limit, from) where
+ * someone waits to go below from, or -1 if there is none
+ */
+static inline int nearest_call_down(const struct trip_table * t, int from,
+				    int limit)
+{
+	int floor;
+
+	if (limit < 1)
+		limit = 1;
+
+	for (floor = from - 1; floor >= limit; floor--)
+	{
+		if (t->dst_mask[floor - 1] & ((1 << (from - 1)) - 1))
+			return floor;
+	}
+
+	return -1;
+}
+
+
+/* call_dir() returns the direction of a waiting passenger's call,
+ * ETA_UP or ETA_DOWN
+ */
+static inline int call_dir(const Passenger * p)
+{
+	return p->dst < p->src ? ETA_DOWN : ETA_UP;
+}
+
+
+/* load_halves() returns count passengers' weight, in half units */
+static inline int load_halves(int count, int weight_int, int weight_dec)
+{
+	return count * (weight_int * 2 + weight_dec / 5);
+}
+
+
+/* load_adjust() adds group p to load (sign 1) or takes it off (sign
+ * -1); weights are added in half units so the .5 weights carry exactly
+ */
+static inline void load_adjust(struct car_load * load, const Passenger * p,
+			       int sign)
+{
+	int halves = load_halves(1, load->weight_int, load->weight_dec) +
+		sign * load_halves(p->count, p->weight_int, p->weight_dec);
+
+	load->pass_units += sign * p->count * p->pass_units;
+	load->weight_int = halves / 2;
+	load->weight_dec = halves % 2 * 5;
+}
+
+
+/* group_fit() returns how many members of group p fit in a car
+ * already carrying load
+ */
+static inline int group_fit(const struct car_load * load, const Passenger * p)
+{
+	int units = MAX_PASSENGER_UNITS - load->pass_units;
+	int halves = load_halves(1, MAX_WEIGHT_INT, MAX_WEIGHT_DEC) -
+		load_halves(1, load->weight_int, load->weight_dec);
+	int fit = p->count;
+
+	if (units / p->pass_units < fit)
+		fit = units / p->pass_units;
+
+	if (halves / load_halves(1, p->weight_int, p->weight_dec) < fit)
+		fit = halves / load_halves(1, p->weight_int, p->weight_dec);
+
+	return fit > 0 ? fit : 0;
+}
+
+
+/* find_next_floor_up() returns the next stop above current_floor for
+ * a car carrying load: the nearest rider's destination (riders_to is
+ * riders by destination floor) or a nearer pickup going up; -1 if
+ * there is none or the car is empty
+ */
+static inline int find_next_floor_up(const struct car_load * load,
+				     const int * riders_to,
+				     const struct trip_table * t,
+				     int current_floor)
+{
+	int next_floor = -1;
+	int floor;
+
+	if (load->pass_units == 0)
+		return -1;
+
+	for (floor = current_floor + 1; floor <= 10; floor++)
+	{
+		if (riders_to[floor - 1] > 0)
+		{
+			next_floor = floor;
+			break;
+		}
+	}
+
+	floor = nearest_call_up(t, current_floor,
+				next_floor > 0 ? next_floor : 10);
+
+	return floor > 0 ? floor : next_floor;
+}
+
+
+/* find_next_floor_down() is find_next_floor_up() going down */
+static inline int find_next_floor_down(const struct car_load * load,
+				       const int * riders_to,
+				       const struct trip_table * t,
+				       int current_floor)
+{
+	int next_floor = -1;
+	int floor;
+
+	if (load->pass_units == 0)
+		return -1;
+
+	for (floor = current_floor - 1; floor >= 1; floor--)
+	{
+		if (riders_to[floor - 1] > 0)
+		{
+			next_floor = floor;
+			break;
+		}
+	}
+
+	floor = nearest_call_down(t, current_floor,
+				  next_floor > 0 ? next_floor : 1);
+
+	return floor > 0 ? floor : next_floor;
+}
+
+
+/* plan_direction() picks the way a car leaving floor from goes, and
+ * its first stop: towards seed, stopping first at the nearest stop on
+ * the way. A starved floor (see starved_floor(), -1 for none) replaces
+ * the seed, and the car does not run past it to a farther stop.
+ * Returns 1 for up or -1 for down, with the stop in *next
+ */
+static inline int plan_direction(const struct car_load * load,
+				 const int * riders_to,
+				 const struct trip_table * t, int from,
+				 int seed, int starved, int * next)
+{
+	int stop;
+
+	*next = starved > 0 ? starved : seed;
+
+	if (*next > from)
+	{
+		stop = find_next_floor_up(load, riders_to, t, from);
+		if (stop > 0 && (starved < 0 || stop < starved))
+			*next = stop;
+
+		return 1;
+	}
+
+	stop = find_next_floor_down(load, riders_to, t, from);
+	if (stop > 0 && (starved < 0 || stop > starved))
+		*next = stop;
+
+	return -1;
+}
+
+
+/* the timing of a building, read from its parameters once for each
+ * use: door dwell (see stop_dwell_ms()) and travel (see run_time_ms())
+ */
+struct elev_timing
+{
+	unsigned int dwell_min_ms;
+	unsigned int dwell_max_ms;
+	unsigned int dwell_base_ms;
+	unsigned int dwell_per_passenger_ms;
+	unsigned int travel_floor_ms;
+	unsigned int travel_accel_ms;
+};
+
+
+/* stop_dwell_ms() returns how long the doors stay open at a stop
+ * where moved passengers boarded or alighted
+ */
+static inline unsigned int stop_dwell_ms(const struct elev_timing * tm,
+					 int moved)
+{
+	unsigned int dwell = tm->dwell_min_ms;
+
+	if (moved > 0)
+		dwell = tm->dwell_base_ms + moved * tm->dwell_per_passenger_ms;
+
+	if (dwell < tm->dwell_min_ms)
+		dwell = tm->dwell_min_ms;
+	if (dwell > tm->dwell_max_ms)
+		dwell = tm->dwell_max_ms;
+
+	return dwell;
+}
+
+
+#ifdef __KERNEL__
+
+/* no estimate for a floor and direction */
+#define ETA_UNKNOWN U32_MAX
+
+
+/* split_group() detaches n members of group p into a new node, for
+ * when the car can only take part of it; the issue-time spread is
+ * shared out evenly. Returns NULL if memory is short
+ */
+static inline Passenger * split_group(Passenger * p, int n)
+{
+	Passenger * q = kmalloc(sizeof(Passenger), __GFP_RECLAIM);
+
+	if (q == NULL)
+		return NULL;
+
+	*q = *p;
+	INIT_LIST_HEAD(&q->floor);
+	q->count = n;
+	q->issued_spread_ns = div_u64(p->issued_spread_ns * n, p->count);
+
+	p->count -= n;
+	p->issued_spread_ns -= q->issued_spread_ns;
+
+	return q;
+}
+
+
+/* at most one riding group per passenger unit, and one waiting group
+ * per destination and type on the car's floor
+ */
+#define STOP_WALK_BOUND (MAX_PASSENGER_UNITS + 10 * 4)
+
+/* the counts a building keeps in step with its queues and its car, by
+ * floor: the car's load, passengers waiting on each floor and riding
+ * to each, calls by direction, and the trip table
+ */
+struct stop_books
+{
+	struct car_load * load;
+	int * waiting;
+	int * riders_to;
+	int (*calls)[10];
+	struct trip_table * trips;
+};
+
+/* the walks below report every group that moves through these, so the
+ * caller can count and time it: board and alight are called before
+ * the load changes, alight also before the group is freed, and arrive
+ * for a group whose trip ends on the floor it waits on, which boards
+ * and alights at once. Any of them may be NULL
+ */
+struct stop_hooks
+{
+	void (*board)(void * ctx, Passenger * p, u64 now);
+	void (*alight)(void * ctx, Passenger * p, u64 now);
+	void (*arrive)(void * ctx, Passenger * p, u64 now);
+	void * ctx;
+};
+
+
+/* queue_group() queues group p on waiting (linked by list, in issue
+ * order) and on queue, its floor's queue (linked by floor), and
+ * counts it in b; if a group making the same trip with the same type
+ * already waits there, p joins it instead and is freed
+ */
+static inline void queue_group(const struct stop_books * b,
+			       struct list_head * waiting,
+			       struct list_head * queue, Passenger * p)
+{
+	struct list_head * temp;
+	Passenger * w;
+
+	b->waiting[p->src - 1] += p->count;
+	b->calls[call_dir(p)][p->src - 1] += p->count;
+	trip_count(b->trips, p->src, p->dst, p->count);
+
+	list_for_each(temp, queue)
+	{
+		w = list_entry(temp, Passenger, floor);
+
+		if (w->dst == p->dst && w->p_type == p->p_type)
+		{
+			w->count += p->count;
+			w->issued_spread_ns +=
+				(p->issued_ns - w->issued_ns) * p->count +
+				p->issued_spread_ns;
+			kfree(p);
+			return;
+		}
+	}
+
+	list_add_tail(&p->list, waiting);
+	list_add_tail(&p->floor, queue);
+}
+
+
+/* board_walk() boards, from queue (floor's queue), every group that
+ * fits onto riding (linked by list), splitting a group that only
+ * partly fits, and lets out on the spot any whose trip ends on floor.
+ * Adds the passengers moved to *moved; returns how many groups it
+ * walked, which is at most the queue's length
+ */
+static inline int board_walk(const struct stop_books * b,
+			     struct list_head * queue,
+			     struct list_head * riding, int floor, u64 now,
+			     const struct stop_hooks * h, int * moved)
+{
+	struct list_head * temp;
+	struct list_head * dummy;
+	Passenger * p;
+	Passenger * q;
+	int walked = 0;
+	int fit;
+
+	list_for_each_safe(temp, dummy, queue)
+	{
+		p = list_entry(temp, Passenger, floor);
+		walked++;
+
+		// passengers already on their destination floor
+		// are done as soon as the doors open
+		if (p->dst == floor)
+		{
+			b->waiting[floor - 1] -= p->count;
+			b->calls[call_dir(p)][p->src - 1] -= p->count;
+			trip_count(b->trips, p->src, p->dst, -p->count);
+
+			if (h->arrive != NULL)
+				h->arrive(h->ctx, p, now);
+
+			*moved += p->count;
+			list_del(&p->list);
+			list_del(temp);
+			kfree(p);
+			continue;
+		}
+
+		fit = group_fit(b->load, p);
+		if (fit == 0)
+			continue;
+
+		// the rest of the group keeps its place in line
+		if (fit < p->count)
+		{
+			q = split_group(p, fit);
+			if (q == NULL)
+				continue;
+
+			list_add_tail(&q->list, riding);
+			p = q;
+		}
+		else
+		{
+			list_del(temp);
+			list_move_tail(&p->list, riding);
+		}
+
+		p->boarded_ns = now;
+
+		if (h->board != NULL)
+			h->board(h->ctx, p, now);
+
+		load_adjust(b->load, p, 1);
+
+		b->waiting[floor - 1] -= p->count;
+		b->calls[call_dir(p)][p->src - 1] -= p->count;
+		b->riders_to[p->dst - 1] += p->count;
+		trip_count(b->trips, p->src, p->dst, -p->count);
+
+		*moved += p->count;
+	}
+
+	return walked;
+}
+
+
+/* alight_walk() lets every group on riding (linked by list) whose
+ * trip ends on floor off the car and frees it. Adds the passengers
+ * moved to *moved; returns how many groups it walked, which is at
+ * most the number riding
+ */
+static inline int alight_walk(const struct stop_books * b,
+			      struct list_head * riding, int floor, u64 now,
+			      const struct stop_hooks * h, int * moved)
+{
+	struct list_head * temp;
+	struct list_head * dummy;
+	Passenger * p;
+	int walked = 0;
+
+	list_for_each_safe(temp, dummy, riding)
+	{
+		p = list_entry(temp, Passenger, list);
+		walked++;
+
+		if (p->dst != floor)
+			continue;
+
+		if (h->alight != NULL)
+			h->alight(h->ctx, p, now);
+
+		load_adjust(b->load, p, -1);
+		b->riders_to[p->dst - 1] -= p->count;
+		*moved += p->count;
+
+		list_del(temp);
+		kfree(p);
+	}
+
+	return walked;
+}
+
+
+/* starved_floor() returns the floor of the longest-waiting group on
+ * waiting (linked by list, in issue order) that has waited at least
+ * bound ns by now and is not on the car's floor already, or -1 if
+ * none has or bound is 0; the scan stops at the first group still
+ * within the bound
+ */
+static inline int starved_floor(struct list_head * waiting, int floor,
+				u64 now, u64 bound)
+{
+	struct list_head * temp;
+	Passenger * p;
+
+	if (bound == 0)
+		return -1;
+
+	list_for_each(temp, waiting)
+	{
+		p = list_entry(temp, Passenger, list);
+
+		if (now - p->issued_ns < bound)
+			break;
+
+		if (p->src != floor)
+			return p->src;
+	}
+
+	return -1;
+}
+
+
+/* run_time_ms() returns how long a run of the given number of floors
+ * takes from rest to rest: the car accelerates for travel_accel_ms up
+ * to a cruise speed of one floor per travel_floor_ms and brakes just
+ * as long at the end; hops too short to reach cruise speed accelerate
+ * for half the distance and brake for the other half
+ */
+static inline unsigned int run_time_ms(const struct elev_timing * tm,
+				       int floors)
+{
+	unsigned int t_floor = tm->travel_floor_ms;
+	unsigned int t_accel = tm->travel_accel_ms;
+
+	if (floors <= 0)
+		return 0;
+
+	// accelerating and braking together cover t_accel / t_floor floors
+	if ((u64)floors * t_floor >= t_accel)
+		return floors * t_floor + t_accel;
+
+	return 2 * int_sqrt((unsigned long)floors * t_floor * t_accel);
+}
+
+
+/* brake_time_ms() returns how long before the end of a run of the
+ * given number of floors the car starts braking
+ */
+static inline unsigned int brake_time_ms(const struct elev_timing * tm,
+					 int floors)
+{
+	unsigned int total = run_time_ms(tm, floors);
+
+	return min(tm->travel_accel_ms, total / 2);
+}
+
+
+/* eta_clear() forgets every estimate in eta */
+static inline void eta_clear(u32 eta[2][10])
+{
+	int f;
+
+	for (f = 1; f <= 10; f++)
+	{
+		eta[ETA_UP][f - 1] = ETA_UNKNOWN;
+		eta[ETA_DOWN][f - 1] = ETA_UNKNOWN;
+	}
+}
+
+
+/* eta_set() records t (ms) as the estimate for floor f in direction
+ * dir, unless an earlier part of the sweep already reaches it
+ */
+static inline void eta_set(u32 eta[2][10], int dir, int f, u64 t)
+{
+	u32 * e = &eta[dir > 0 ? ETA_UP : ETA_DOWN][f - 1];
+
+	if (*e == ETA_UNKNOWN)
+		*e = min_t(u64, t, ETA_UNKNOWN - 1);
+}
+
+
+/* eta_leg() follows the car from floor *last in direction dir to the
+ * farthest stop still pending that way, advancing *t (ms) by every run
+ * and dwell and consuming the stops it serves. A call on a floor
+ * passed on the way is picked up in passing; a call beyond the last
+ * stop, or against the direction at the turning point, is reached by
+ * running on and turning there
+ */
+static inline void eta_leg(u32 eta[2][10], const struct elev_timing * tm,
+			   int * riders, int calls[2][10], int dir,
+			   int * last, u64 * t)
+{
+	int ahead = dir > 0 ? ETA_UP : ETA_DOWN;
+	int behind = dir > 0 ? ETA_DOWN : ETA_UP;
+	int from = *last;
+	int far = from;
+	int moved;
+	int f;
+	u64 arrive;
+
+	for (f = from + dir; f >= 1 && f <= 10; f += dir)
+	{
+		if (riders[f - 1] > 0 || calls[ETA_UP][f - 1] > 0 ||
+			calls[ETA_DOWN][f - 1] > 0)
+			far = f;
+	}
+
+	for (f = from + dir; f >= 1 && f <= 10; f += dir)
+	{
+		arrive = *t + run_time_ms(tm, abs(f - *last));
+		eta_set(eta, dir, f, arrive);
+
+		if ((f - far) * dir >= 0)
+			eta_set(eta, -dir, f, arrive);
+
+		moved = riders[f - 1] + calls[ahead][f - 1];
+		if (f == far)
+			moved += calls[behind][f - 1];
+
+		if (moved == 0)
+			continue;
+
+		*t = arrive + stop_dwell_ms(tm, moved);
+		*last = f;
+		riders[f - 1] = 0;
+		calls[ahead][f - 1] = 0;
+		if (f == far)
+			calls[behind][f - 1] = 0;
+	}
+}
+
+
+/* eta_sweep() fills the cleared eta for a car that opens its doors on
+ * floor last t ms from now, with riders (by destination) and calls
+ * (by floor and direction) pending, which it consumes: the car goes on
+ * in direction dir to the last stop that way, back to the last stop
+ * the other way, and round again
+ */
+static inline void eta_sweep(u32 eta[2][10], const struct elev_timing * tm,
+			     int * riders, int calls[2][10], int dir,
+			     int last, u64 t)
+{
+	int moved;
+
+	eta_set(eta, 1, last, t);
+	eta_set(eta, -1, last, t);
+
+	moved = riders[last - 1] + calls[ETA_UP][last - 1] +
+		calls[ETA_DOWN][last - 1];
+	t += stop_dwell_ms(tm, moved);
+	riders[last - 1] = 0;
+	calls[ETA_UP][last - 1] = 0;
+	calls[ETA_DOWN][last - 1] = 0;
+
+	eta_leg(eta, tm, riders, calls, dir, &last, &t);
+	eta_leg(eta, tm, riders, calls, -dir, &last, &t);
+	eta_leg(eta, tm, riders, calls, dir, &last, &t);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,22 @@
+#include <linux/linkage.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/syscalls.h>
+
+#include "elevator_ops.h"
+
+/* System call wrapper; dispatches to the registered elevator module */
+SYSCALL_DEFINE3(elevator_eta, int, building, int, start_floor,
+		int, dest_floor)
+{
+	const struct elevator_ops * ops = elevator_ops_get();
+	int ret;
+
+	if (ops == NULL)
+		return -ENOSYS;
+
+	ret = static_call(elevator_eta)(building, start_floor, dest_floor);
+	elevator_ops_put(ops);
+
+	return ret;
+}
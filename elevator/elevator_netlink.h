@@ -0,0 +1,48 @@
+#ifndef ELEVATOR_NETLINK_H
+#define ELEVATOR_NETLINK_H
+
+/* The elevator module multicasts events on the "events" group of the
+ * "elevator" generic netlink family. Every event carries the building
+ * handle, a CLOCK_MONOTONIC timestamp and the car's state and floor;
+ * board, alight and request events also carry the passenger's source
+ * and destination floors, size in passenger units and, since identical
+ * trips travel as one group, how many passengers the event covers.
+ *
+ * This header is shared with userspace listeners, so it only holds
+ * constants.
+ */
+
+#define ELEVATOR_GENL_NAME "elevator"
+#define ELEVATOR_GENL_VERSION 1
+#define ELEVATOR_GENL_MCGRP "events"
+
+/* genlmsghdr.cmd of each event */
+enum Elevator_Events
+{
+	ELEVATOR_EVENT_UNSPEC,
+	ELEVATOR_EVENT_STATE,		// the car changed state
+	ELEVATOR_EVENT_ARRIVE,		// the car stopped at a floor
+	ELEVATOR_EVENT_BOARD,		// a passenger got on
+	ELEVATOR_EVENT_ALIGHT,		// a passenger got off
+	ELEVATOR_EVENT_REQUEST,		// a request was accepted
+	NUM_ELEVATOR_EVENTS
+};
+
+enum Elevator_Attrs
+{
+	ELEVATOR_A_UNSPEC,
+	ELEVATOR_A_PAD,
+	ELEVATOR_A_BUILDING,		// u32, the system call handle
+	ELEVATOR_A_TIME_NS,		// u64, CLOCK_MONOTONIC
+	ELEVATOR_A_STATE,		// u8, OFFLINE IDLE LOADING UP DOWN
+	ELEVATOR_A_FLOOR,		// u8, 0 while OFFLINE
+	ELEVATOR_A_SRC,			// u8
+	ELEVATOR_A_DST,			// u8
+	ELEVATOR_A_UNITS,		// u8, passenger units
+	ELEVATOR_A_COUNT,		// u32, passengers in the group
+	NUM_ELEVATOR_A
+};
+
+#define ELEVATOR_A_MAX (NUM_ELEVATOR_A - 1)
+
+#endif
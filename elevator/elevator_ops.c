@@ -0,0 +1,106 @@
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/static_call.h>
+
+#include "elevator_ops.h"
+
+/* Registration point between the built-in system call stubs and the
+ * elevator module. The stubs call through static calls, so the common
+ * path is a direct call into the module; the RCU-protected table and
+ * the module reference taken by elevator_ops_get() keep the module
+ * text alive for as long as a call is in flight
+ */
+
+int elevator_start_nosys(int building)
+{
+	return -ENOSYS;
+}
+
+
+int elevator_issue_nosys(int building, int p_type, int start_floor,
+			 int dest_floor)
+{
+	return -ENOSYS;
+}
+
+
+int elevator_stop_nosys(int building)
+{
+	return -ENOSYS;
+}
+
+
+int elevator_eta_nosys(int building, int start_floor, int dest_floor)
+{
+	return -ENOSYS;
+}
+
+
+DEFINE_STATIC_CALL(elevator_start, elevator_start_nosys);
+DEFINE_STATIC_CALL(elevator_issue, elevator_issue_nosys);
+DEFINE_STATIC_CALL(elevator_stop, elevator_stop_nosys);
+DEFINE_STATIC_CALL(elevator_eta, elevator_eta_nosys);
+
+const struct elevator_ops __rcu * elevator_ops_table;
+
+/* serializes register/unregister */
+static DEFINE_MUTEX(elevator_ops_mutex);
+
+
+/* elevator_register_ops() points the stubs at a module's
+ * implementation; only one table can be registered at a time
+ */
+int elevator_register_ops(const struct elevator_ops * ops)
+{
+	int ret = 0;
+
+	mutex_lock(&elevator_ops_mutex);
+
+	if (rcu_dereference_protected(elevator_ops_table,
+			lockdep_is_held(&elevator_ops_mutex)) != NULL)
+	{
+		ret = -EBUSY;
+	}
+	else
+	{
+		// the targets are in place before the table is published,
+		// so a caller that sees the table always reaches the module
+		static_call_update(elevator_start, ops->start_elevator);
+		static_call_update(elevator_issue, ops->issue_request);
+		static_call_update(elevator_stop, ops->stop_elevator);
+		static_call_update(elevator_eta, ops->elevator_eta);
+		rcu_assign_pointer(elevator_ops_table, ops);
+	}
+
+	mutex_unlock(&elevator_ops_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(elevator_register_ops);
+
+
+/* elevator_unregister_ops() detaches a module's implementation; once
+ * it returns no new caller can enter the module, and callers already
+ * inside hold a reference that keeps the module from being freed
+ */
+void elevator_unregister_ops(const struct elevator_ops * ops)
+{
+	mutex_lock(&elevator_ops_mutex);
+
+	if (rcu_dereference_protected(elevator_ops_table,
+			lockdep_is_held(&elevator_ops_mutex)) == ops)
+	{
+		RCU_INIT_POINTER(elevator_ops_table, NULL);
+		synchronize_rcu();
+
+		static_call_update(elevator_start, elevator_start_nosys);
+		static_call_update(elevator_issue, elevator_issue_nosys);
+		static_call_update(elevator_stop, elevator_stop_nosys);
+		static_call_update(elevator_eta, elevator_eta_nosys);
+	}
+
+	mutex_unlock(&elevator_ops_mutex);
+}
+EXPORT_SYMBOL_GPL(elevator_unregister_ops);
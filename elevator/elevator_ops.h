@@ -0,0 +1,64 @@
+#ifndef ELEVATOR_OPS_H
+#define ELEVATOR_OPS_H
+
+#include <linux/module.h>
+#include <linux/rcupdate.h>
+#include <linux/static_call.h>
+
+/* The elevator module hands its system call implementations to the
+ * built-in stubs as one table; owner is pinned for the duration of
+ * every call, so the module cannot be unloaded under a caller. Every
+ * call takes the handle of the building it acts on first
+ */
+struct elevator_ops
+{
+	struct module * owner;
+	int (*start_elevator)(int);
+	int (*issue_request)(int, int, int, int);
+	int (*stop_elevator)(int);
+	int (*elevator_eta)(int, int, int);
+};
+
+int elevator_register_ops(const struct elevator_ops * ops);
+void elevator_unregister_ops(const struct elevator_ops * ops);
+
+
+/* what the stubs dispatch to while no module is registered */
+int elevator_start_nosys(int building);
+int elevator_issue_nosys(int building, int p_type, int start_floor,
+			 int dest_floor);
+int elevator_stop_nosys(int building);
+int elevator_eta_nosys(int building, int start_floor, int dest_floor);
+
+DECLARE_STATIC_CALL(elevator_start, elevator_start_nosys);
+DECLARE_STATIC_CALL(elevator_issue, elevator_issue_nosys);
+DECLARE_STATIC_CALL(elevator_stop, elevator_stop_nosys);
+DECLARE_STATIC_CALL(elevator_eta, elevator_eta_nosys);
+
+extern const struct elevator_ops __rcu * elevator_ops_table;
+
+
+/* elevator_ops_get() returns the registered table with a reference on
+ * its module, or NULL if no module is loaded (or it is going away);
+ * every non-NULL return must be paired with elevator_ops_put()
+ */
+static inline const struct elevator_ops * elevator_ops_get(void)
+{
+	const struct elevator_ops * ops;
+
+	rcu_read_lock();
+	ops = rcu_dereference(elevator_ops_table);
+	if (ops != NULL && !try_module_get(ops->owner))
+		ops = NULL;
+	rcu_read_unlock();
+
+	return ops;
+}
+
+
+static inline void elevator_ops_put(const struct elevator_ops * ops)
+{
+	module_put(ops->owner);
+}
+
+#endif
@@ -0,0 +1,755 @@
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "elevator_dispatch.h"
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("KUnit tests of the elevator dispatch core");
+
+/* The dispatch core (elevator_dispatch.h) run over made-up passengers,
+ * with no building, service thread or elevator module behind it: the
+ * helpers on hand-made cases, and the boarding and alighting walks on
+ * buildings filled and drained here, checking that every passenger is
+ * delivered exactly once and that no stop walks more than
+ * STOP_WALK_BOUND groups. The results are reported by KUnit when this
+ * module is loaded into a kernel built with CONFIG_KUNIT, or by
+ * kunit.py run (see .kunitconfig)
+ */
+
+/* passenger units and weight of each passenger type, as issued */
+static const int type_units[5] = { 0, 1, 1, 2, 2 };
+static const int type_weight_int[5] = { 0, 1, 0, 2, 3 };
+static const int type_weight_dec[5] = { 0, 0, 5, 0, 0 };
+
+
+/* group_init() makes p a group of count passengers of type p_type
+ * waiting on src for dst
+ */
+static void group_init(Passenger * p, int p_type, int src, int dst,
+		       int count)
+{
+	memset(p, 0, sizeof(*p));
+	p->src = src;
+	p->dst = dst;
+	p->p_type = p_type;
+	p->count = count;
+	p->pass_units = type_units[p_type];
+	p->weight_int = type_weight_int[p_type];
+	p->weight_dec = type_weight_dec[p_type];
+	INIT_LIST_HEAD(&p->list);
+	INIT_LIST_HEAD(&p->floor);
+}
+
+
+/* test_group() returns a group made by group_init(), freed with the
+ * test
+ */
+static Passenger * test_group(struct kunit * test, int p_type, int src,
+			      int dst, int count)
+{
+	Passenger * p = kunit_kzalloc(test, sizeof(*p), GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, p);
+	group_init(p, p_type, src, dst, count);
+
+	return p;
+}
+
+
+/* xorshift, so the synthetic passenger sets are the same every run */
+static u32 test_rng(u32 * state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+
+/*************************************************************************/
+
+
+static void trip_count_keeps_masks(struct kunit * test)
+{
+	struct trip_table t;
+
+	memset(&t, 0, sizeof(t));
+
+	trip_count(&t, 3, 7, 2);
+	KUNIT_EXPECT_EQ(test, t.count[2][6], 2);
+	KUNIT_EXPECT_EQ(test, t.dst_mask[2], (u16)(1 << 6));
+
+	trip_count(&t, 3, 1, 1);
+	KUNIT_EXPECT_EQ(test, t.dst_mask[2], (u16)(1 << 6 | 1 << 0));
+
+	// the bit stays while anyone is left on the trip
+	trip_count(&t, 3, 7, -1);
+	KUNIT_EXPECT_EQ(test, t.dst_mask[2], (u16)(1 << 6 | 1 << 0));
+
+	trip_count(&t, 3, 7, -1);
+	trip_count(&t, 3, 1, -1);
+	KUNIT_EXPECT_EQ(test, t.count[2][6], 0);
+	KUNIT_EXPECT_EQ(test, t.dst_mask[2], (u16)0);
+}
+
+
+static void nearest_calls(struct kunit * test)
+{
+	struct trip_table t;
+
+	memset(&t, 0, sizeof(t));
+	trip_count(&t, 5, 9, 1);
+	trip_count(&t, 7, 2, 1);
+
+	// from floor 1 both go above it, and 5 is nearer
+	KUNIT_EXPECT_EQ(test, nearest_call_up(&t, 1, 10), 5);
+	KUNIT_EXPECT_EQ(test, nearest_call_up(&t, 1, 4), -1);
+
+	// from 5 the call on 7 goes back down, so there is none
+	KUNIT_EXPECT_EQ(test, nearest_call_up(&t, 5, 10), -1);
+
+	KUNIT_EXPECT_EQ(test, nearest_call_down(&t, 10, 1), 7);
+	KUNIT_EXPECT_EQ(test, nearest_call_down(&t, 8, 6), 7);
+	KUNIT_EXPECT_EQ(test, nearest_call_down(&t, 7, 1), -1);
+
+	// limits past the building are clamped
+	KUNIT_EXPECT_EQ(test, nearest_call_up(&t, 1, 42), 5);
+	KUNIT_EXPECT_EQ(test, nearest_call_down(&t, 10, -3), 7);
+}
+
+
+static void group_fit_by_units_and_weight(struct kunit * test)
+{
+	struct car_load load = { 0, 0, 0 };
+	Passenger g;
+
+	// type 4: five fill the units and the weight at once
+	group_init(&g, 4, 1, 5, 8);
+	KUNIT_EXPECT_EQ(test, group_fit(&load, &g), 5);
+
+	// type 2: the units run out long before the weight
+	group_init(&g, 2, 1, 5, 30);
+	KUNIT_EXPECT_EQ(test, group_fit(&load, &g), 10);
+
+	// three type 4 aboard leave 4 units and 6.0 weight
+	group_init(&g, 4, 1, 5, 3);
+	load_adjust(&load, &g, 1);
+
+	group_init(&g, 1, 1, 5, 10);
+	KUNIT_EXPECT_EQ(test, group_fit(&load, &g), 4);
+	group_init(&g, 4, 1, 5, 10);
+	KUNIT_EXPECT_EQ(test, group_fit(&load, &g), 2);
+
+	load.pass_units = MAX_PASSENGER_UNITS;
+	group_init(&g, 2, 1, 5, 1);
+	KUNIT_EXPECT_EQ(test, group_fit(&load, &g), 0);
+}
+
+
+static void load_adjust_carries_halves(struct kunit * test)
+{
+	struct car_load load = { 0, 0, 0 };
+	Passenger * halves = test_group(test, 2, 1, 5, 3);
+	Passenger * adult = test_group(test, 3, 1, 5, 1);
+
+	load_adjust(&load, halves, 1);
+	KUNIT_EXPECT_EQ(test, load.pass_units, 3);
+	KUNIT_EXPECT_EQ(test, load.weight_int, 1);
+	KUNIT_EXPECT_EQ(test, load.weight_dec, 5);
+
+	load_adjust(&load, adult, 1);
+	KUNIT_EXPECT_EQ(test, load.pass_units, 5);
+	KUNIT_EXPECT_EQ(test, load.weight_int, 3);
+	KUNIT_EXPECT_EQ(test, load.weight_dec, 5);
+
+	load_adjust(&load, halves, -1);
+	KUNIT_EXPECT_EQ(test, load.pass_units, 2);
+	KUNIT_EXPECT_EQ(test, load.weight_int, 2);
+	KUNIT_EXPECT_EQ(test, load.weight_dec, 0);
+
+	load_adjust(&load, adult, -1);
+	KUNIT_EXPECT_EQ(test, load.pass_units, 0);
+	KUNIT_EXPECT_EQ(test, load.weight_int, 0);
+	KUNIT_EXPECT_EQ(test, load.weight_dec, 0);
+}
+
+
+static void split_group_shares_spread(struct kunit * test)
+{
+	Passenger * p = test_group(test, 1, 2, 8, 5);
+	Passenger * q;
+
+	p->issued_spread_ns = 1000;
+
+	q = split_group(p, 2);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, q);
+
+	KUNIT_EXPECT_EQ(test, q->count, 2);
+	KUNIT_EXPECT_EQ(test, p->count, 3);
+	KUNIT_EXPECT_EQ(test, q->issued_spread_ns, (u64)400);
+	KUNIT_EXPECT_EQ(test, p->issued_spread_ns, (u64)600);
+	KUNIT_EXPECT_EQ(test, q->dst, p->dst);
+
+	// the part that boards is on no floor queue
+	KUNIT_EXPECT_TRUE(test, list_empty(&q->floor));
+
+	kfree(q);
+}
+
+
+static void next_floors(struct kunit * test)
+{
+	struct car_load load = { 1, 1, 0 };
+	struct car_load empty = { 0, 0, 0 };
+	struct trip_table t;
+	int riders_to[10] = { 0 };
+
+	memset(&t, 0, sizeof(t));
+	riders_to[9 - 1] = 1;
+	trip_count(&t, 4, 6, 1);
+	trip_count(&t, 6, 3, 1);
+
+	// the pickup on 4 comes before the rider's floor
+	KUNIT_EXPECT_EQ(test, find_next_floor_up(&load, riders_to, &t, 2), 4);
+	KUNIT_EXPECT_EQ(test, find_next_floor_up(&load, riders_to, &t, 4), 9);
+
+	// nobody rides down, so the nearest call below decides
+	KUNIT_EXPECT_EQ(test, find_next_floor_down(&load, riders_to, &t, 8), 6);
+	KUNIT_EXPECT_EQ(test, find_next_floor_down(&load, riders_to, &t, 3),
+			-1);
+
+	KUNIT_EXPECT_EQ(test, find_next_floor_up(&empty, riders_to, &t, 2),
+			-1);
+	KUNIT_EXPECT_EQ(test, find_next_floor_down(&empty, riders_to, &t, 8),
+			-1);
+}
+
+
+static void plan_direction_honours_starved(struct kunit * test)
+{
+	struct car_load load = { 1, 1, 0 };
+	struct car_load empty = { 0, 0, 0 };
+	struct trip_table t;
+	int riders_to[10] = { 0 };
+	int next;
+
+	memset(&t, 0, sizeof(t));
+	riders_to[9 - 1] = 1;
+	trip_count(&t, 4, 6, 1);
+
+	KUNIT_EXPECT_EQ(test, plan_direction(&load, riders_to, &t, 2, 9, -1,
+					     &next), 1);
+	KUNIT_EXPECT_EQ(test, next, 4);
+
+	// the car does not run past a starved floor to the pickup
+	KUNIT_EXPECT_EQ(test, plan_direction(&load, riders_to, &t, 2, 9, 3,
+					     &next), 1);
+	KUNIT_EXPECT_EQ(test, next, 3);
+
+	// a starved floor behind the car turns it round
+	KUNIT_EXPECT_EQ(test, plan_direction(&load, riders_to, &t, 2, 9, 1,
+					     &next), -1);
+	KUNIT_EXPECT_EQ(test, next, 1);
+
+	// an empty car goes straight for the seed
+	KUNIT_EXPECT_EQ(test, plan_direction(&empty, riders_to, &t, 2, 7, -1,
+					     &next), 1);
+	KUNIT_EXPECT_EQ(test, next, 7);
+}
+
+
+static void starved_floor_in_issue_order(struct kunit * test)
+{
+	LIST_HEAD(waiting);
+	Passenger * a = test_group(test, 1, 4, 9, 1);
+	Passenger * b = test_group(test, 1, 2, 9, 1);
+	Passenger * c = test_group(test, 1, 6, 9, 1);
+
+	a->issued_ns = 100;
+	b->issued_ns = 200;
+	c->issued_ns = 900;
+	list_add_tail(&a->list, &waiting);
+	list_add_tail(&b->list, &waiting);
+	list_add_tail(&c->list, &waiting);
+
+	KUNIT_EXPECT_EQ(test, starved_floor(&waiting, 1, 1000, 500), 4);
+
+	// the car is already on the oldest caller's floor
+	KUNIT_EXPECT_EQ(test, starved_floor(&waiting, 4, 1000, 500), 2);
+
+	KUNIT_EXPECT_EQ(test, starved_floor(&waiting, 1, 1000, 850), 4);
+	KUNIT_EXPECT_EQ(test, starved_floor(&waiting, 1, 1000, 950), -1);
+	KUNIT_EXPECT_EQ(test, starved_floor(&waiting, 1, 1000, 0), -1);
+}
+
+
+static void run_and_dwell_times(struct kunit * test)
+{
+	struct elev_timing tm = { 0, 3000, 500, 100, 2000, 1000 };
+
+	KUNIT_EXPECT_EQ(test, run_time_ms(&tm, 0), 0U);
+	KUNIT_EXPECT_EQ(test, run_time_ms(&tm, 1), 3000U);
+	KUNIT_EXPECT_EQ(test, run_time_ms(&tm, 3), 7000U);
+	KUNIT_EXPECT_EQ(test, brake_time_ms(&tm, 3), 1000U);
+
+	KUNIT_EXPECT_EQ(test, stop_dwell_ms(&tm, 0), 0U);
+	KUNIT_EXPECT_EQ(test, stop_dwell_ms(&tm, 3), 800U);
+	KUNIT_EXPECT_EQ(test, stop_dwell_ms(&tm, 100), 3000U);
+
+	tm.dwell_min_ms = 200;
+	KUNIT_EXPECT_EQ(test, stop_dwell_ms(&tm, 0), 200U);
+
+	// a hop too short to reach cruise speed
+	tm.travel_floor_ms = 500;
+	tm.travel_accel_ms = 2000;
+	KUNIT_EXPECT_EQ(test, run_time_ms(&tm, 1), 2000U);
+	KUNIT_EXPECT_EQ(test, brake_time_ms(&tm, 1), 1000U);
+}
+
+
+static void eta_sweep_up_and_back(struct kunit * test)
+{
+	struct elev_timing tm = { 0, 3000, 500, 0, 1000, 0 };
+	u32 eta[2][10];
+	int riders[10] = { 0 };
+	int calls[2][10] = { { 0 } };
+
+	// doors open on 1 now, a call up on 3 and a rider for 5
+	calls[ETA_UP][3 - 1] = 1;
+	riders[5 - 1] = 1;
+
+	eta_clear(eta);
+	eta_sweep(eta, &tm, riders, calls, 1, 1, 0);
+
+	KUNIT_EXPECT_EQ(test, eta[ETA_UP][1 - 1], 0U);
+	KUNIT_EXPECT_EQ(test, eta[ETA_UP][3 - 1], 2000U);
+
+	// 3 s of runs and the dwell on 3
+	KUNIT_EXPECT_EQ(test, eta[ETA_UP][4 - 1], 3500U);
+	KUNIT_EXPECT_EQ(test, eta[ETA_DOWN][5 - 1], 4500U);
+
+	// above the last stop the car is free to turn either way
+	KUNIT_EXPECT_EQ(test, eta[ETA_UP][10 - 1], 10000U);
+	KUNIT_EXPECT_EQ(test, eta[ETA_DOWN][10 - 1], 10000U);
+
+	// calls down below 5 wait for the way back
+	KUNIT_EXPECT_EQ(test, eta[ETA_DOWN][3 - 1], 7000U);
+
+	KUNIT_EXPECT_EQ(test, calls[ETA_UP][3 - 1], 0);
+	KUNIT_EXPECT_EQ(test, riders[5 - 1], 0);
+}
+
+
+/* walk_call_up() and walk_call_down() answer nearest_call_up() and
+ * nearest_call_down() over the whole building by walking all n trips
+ */
+static int walk_call_up(const int * src, const int * dst, int n, int from)
+{
+	int want = -1;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		if (src[i] > from && dst[i] > from &&
+		    (want < 0 || src[i] < want))
+			want = src[i];
+	}
+
+	return want;
+}
+
+
+static int walk_call_down(const int * src, const int * dst, int n, int from)
+{
+	int want = -1;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		if (src[i] < from && dst[i] < from && src[i] > want)
+			want = src[i];
+	}
+
+	return want;
+}
+
+
+/* synthetic_sets() fills trip tables from random passenger sets and
+ * checks the mask scans against a walk of every trip, and that
+ * loading whatever fits never overloads the car
+ */
+static void synthetic_sets(struct kunit * test)
+{
+	struct trip_table t;
+	struct car_load load;
+	Passenger g;
+	int src[200];
+	int dst[200];
+	int n = ARRAY_SIZE(src);
+	int round;
+	int from;
+	int fit;
+	int i;
+	u32 rng = 0x2545f491;
+
+	for (round = 0; round < 50; round++)
+	{
+		memset(&t, 0, sizeof(t));
+		memset(&load, 0, sizeof(load));
+
+		for (i = 0; i < n; i++)
+		{
+			src[i] = 1 + test_rng(&rng) % 10;
+			dst[i] = 1 + test_rng(&rng) % 10;
+			trip_count(&t, src[i], dst[i], 1);
+		}
+
+		for (from = 1; from <= 10; from++)
+		{
+			KUNIT_EXPECT_EQ(test, nearest_call_up(&t, from, 10),
+					walk_call_up(src, dst, n, from));
+			KUNIT_EXPECT_EQ(test, nearest_call_down(&t, from, 1),
+					walk_call_down(src, dst, n, from));
+		}
+
+		// board a random group of each trip, as much as fits
+		for (i = 0; i < n; i++)
+		{
+			group_init(&g, 1 + test_rng(&rng) % 4, src[i], dst[i],
+				   1 + test_rng(&rng) % 6);
+
+			fit = group_fit(&load, &g);
+			KUNIT_EXPECT_LE(test, fit, g.count);
+
+			g.count = fit;
+			load_adjust(&load, &g, 1);
+			trip_count(&t, src[i], dst[i], -1);
+		}
+
+		KUNIT_EXPECT_LE(test, load.pass_units, MAX_PASSENGER_UNITS);
+		KUNIT_EXPECT_LE(test,
+				load_halves(1, load.weight_int, load.weight_dec),
+				load_halves(1, MAX_WEIGHT_INT, MAX_WEIGHT_DEC));
+
+		for (i = 0; i < 10; i++)
+			KUNIT_EXPECT_EQ(test, t.dst_mask[i], (u16)0);
+	}
+}
+
+
+/* a building's queues and counts for the walks, with every trip
+ * counted as it is issued and as it is delivered
+ */
+struct test_building
+{
+	struct list_head waiting;
+	struct list_head queue[10];
+	struct list_head riding;
+	struct car_load load;
+	struct trip_table trips;
+	int waiting_at[10];
+	int riders_to[10];
+	int calls[2][10];
+	struct stop_books books;
+	struct stop_hooks hooks;
+	int issued[10][10];
+	int delivered[10][10];
+	int boarded;
+};
+
+
+static void test_board(void * ctx, Passenger * p, u64 now)
+{
+	struct test_building * tb = ctx;
+
+	tb->boarded += p->count;
+}
+
+
+static void test_alight(void * ctx, Passenger * p, u64 now)
+{
+	struct test_building * tb = ctx;
+
+	tb->delivered[p->src - 1][p->dst - 1] += p->count;
+}
+
+
+static void building_init(struct test_building * tb)
+{
+	int i;
+
+	memset(tb, 0, sizeof(*tb));
+	INIT_LIST_HEAD(&tb->waiting);
+	INIT_LIST_HEAD(&tb->riding);
+	for (i = 0; i < 10; i++)
+		INIT_LIST_HEAD(&tb->queue[i]);
+
+	tb->books.load = &tb->load;
+	tb->books.waiting = tb->waiting_at;
+	tb->books.riders_to = tb->riders_to;
+	tb->books.calls = tb->calls;
+	tb->books.trips = &tb->trips;
+
+	tb->hooks.board = test_board;
+	tb->hooks.alight = test_alight;
+	tb->hooks.arrive = test_alight;
+	tb->hooks.ctx = tb;
+}
+
+
+/* building_free() frees whoever is still waiting or riding */
+static void building_free(struct test_building * tb)
+{
+	Passenger * p;
+	Passenger * n;
+
+	list_for_each_entry_safe(p, n, &tb->waiting, list)
+		kfree(p);
+	list_for_each_entry_safe(p, n, &tb->riding, list)
+		kfree(p);
+}
+
+
+static void building_issue(struct kunit * test, struct test_building * tb,
+			   int p_type, int src, int dst, u64 now)
+{
+	Passenger * p = kmalloc(sizeof(*p), GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, p);
+	group_init(p, p_type, src, dst, 1);
+	p->issued_ns = now;
+
+	queue_group(&tb->books, &tb->waiting, &tb->queue[src - 1], p);
+	tb->issued[src - 1][dst - 1]++;
+}
+
+
+static int queue_length(struct list_head * queue)
+{
+	struct list_head * temp;
+	int n = 0;
+
+	list_for_each(temp, queue)
+		n++;
+
+	return n;
+}
+
+
+static int trips_sum(int trips[10][10])
+{
+	int sum = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < 10; i++)
+		for (j = 0; j < 10; j++)
+			sum += trips[i][j];
+
+	return sum;
+}
+
+
+/* building_stop() opens the doors on floor: riders for it get off,
+ * then whoever fits gets on. Checks the stop walked no more than
+ * STOP_WALK_BOUND groups, that the car is within capacity, and that
+ * every passenger issued is waiting, riding or delivered
+ */
+static void building_stop(struct kunit * test, struct test_building * tb,
+			  int floor, u64 now)
+{
+	int moved = 0;
+	int walked;
+	int held = 0;
+	int i;
+
+	walked = alight_walk(&tb->books, &tb->riding, floor, now, &tb->hooks,
+			     &moved);
+	walked += board_walk(&tb->books, &tb->queue[floor - 1], &tb->riding,
+			     floor, now, &tb->hooks, &moved);
+
+	KUNIT_EXPECT_LE(test, walked, STOP_WALK_BOUND);
+	KUNIT_EXPECT_LE(test, tb->load.pass_units, MAX_PASSENGER_UNITS);
+	KUNIT_EXPECT_LE(test, load_halves(1, tb->load.weight_int,
+					  tb->load.weight_dec),
+			load_halves(1, MAX_WEIGHT_INT, MAX_WEIGHT_DEC));
+
+	for (i = 0; i < 10; i++)
+		held += tb->waiting_at[i] + tb->riders_to[i];
+
+	KUNIT_EXPECT_EQ(test, trips_sum(tb->issued),
+			trips_sum(tb->delivered) + held);
+}
+
+
+/* building_sweep() runs the car from 1 to 10 and back, stopping on
+ * every floor; returns how many are left waiting or riding
+ */
+static int building_sweep(struct kunit * test, struct test_building * tb,
+			  u64 * now)
+{
+	int left = 0;
+	int floor;
+	int i;
+
+	for (floor = 1; floor <= 10; floor++)
+		building_stop(test, tb, floor, (*now)++);
+	for (floor = 9; floor >= 2; floor--)
+		building_stop(test, tb, floor, (*now)++);
+
+	for (i = 0; i < 10; i++)
+		left += tb->waiting_at[i] + tb->riders_to[i];
+
+	return left;
+}
+
+
+/* building_drained() checks that the walks delivered every trip
+ * issued exactly once and left nothing behind
+ */
+static void building_drained(struct kunit * test, struct test_building * tb)
+{
+	int i;
+	int j;
+
+	for (i = 0; i < 10; i++)
+	{
+		for (j = 0; j < 10; j++)
+			KUNIT_EXPECT_EQ(test, tb->delivered[i][j],
+					tb->issued[i][j]);
+
+		KUNIT_EXPECT_EQ(test, tb->trips.dst_mask[i], (u16)0);
+		KUNIT_EXPECT_EQ(test, tb->calls[ETA_UP][i], 0);
+		KUNIT_EXPECT_EQ(test, tb->calls[ETA_DOWN][i], 0);
+		KUNIT_EXPECT_TRUE(test, list_empty(&tb->queue[i]));
+	}
+
+	KUNIT_EXPECT_TRUE(test, list_empty(&tb->waiting));
+	KUNIT_EXPECT_TRUE(test, list_empty(&tb->riding));
+	KUNIT_EXPECT_EQ(test, tb->load.pass_units, 0);
+	KUNIT_EXPECT_EQ(test, tb->load.weight_int, 0);
+	KUNIT_EXPECT_EQ(test, tb->load.weight_dec, 0);
+}
+
+
+static void queue_group_joins_trips(struct kunit * test)
+{
+	struct test_building tb;
+
+	building_init(&tb);
+	building_issue(test, &tb, 1, 3, 7, 100);
+	building_issue(test, &tb, 1, 3, 7, 300);
+	building_issue(test, &tb, 2, 3, 7, 400);
+	building_issue(test, &tb, 1, 3, 3, 500);
+
+	// the second joins the first; a new type or trip is a new group
+	KUNIT_EXPECT_EQ(test, queue_length(&tb.queue[3 - 1]), 3);
+	KUNIT_EXPECT_EQ(test, tb.waiting_at[3 - 1], 4);
+	KUNIT_EXPECT_EQ(test, tb.calls[ETA_UP][3 - 1], 4);
+	KUNIT_EXPECT_EQ(test, tb.trips.count[3 - 1][7 - 1], 3);
+
+	building_free(&tb);
+}
+
+
+/* walks_deliver_everyone_once() issues random passengers between
+ * sweeps of the car and drains the building
+ */
+static void walks_deliver_everyone_once(struct kunit * test)
+{
+	struct test_building tb;
+	int sweeps = 0;
+	int left;
+	int i;
+	u32 rng = 0x9e3779b9;
+	u64 now = 1;
+
+	building_init(&tb);
+
+	do
+	{
+		for (i = 0; sweeps < 20 && i < 50; i++)
+		{
+			building_issue(test, &tb, 1 + test_rng(&rng) % 4,
+				       1 + test_rng(&rng) % 10,
+				       1 + test_rng(&rng) % 10, now++);
+		}
+
+		left = building_sweep(test, &tb, &now);
+	}
+	while (left > 0 && ++sweeps < 1000);
+
+	KUNIT_EXPECT_EQ(test, left, 0);
+	KUNIT_EXPECT_EQ(test, trips_sum(tb.issued), 1000);
+	building_drained(test, &tb);
+	building_free(&tb);
+}
+
+
+/* walks_stay_within_bound() fills every floor with every trip of
+ * every type, many times over, so groups are joined and split at
+ * every stop, and drains it
+ */
+static void walks_stay_within_bound(struct kunit * test)
+{
+	struct test_building tb;
+	int sweeps = 0;
+	int src;
+	int dst;
+	int t;
+	int n;
+	u64 now = 1;
+
+	building_init(&tb);
+
+	for (n = 0; n < 5 * 10 * 10 * 4; n++)
+	{
+		t = 1 + n % 4;
+		dst = 1 + n / 4 % 10;
+		src = 1 + n / 40 % 10;
+		building_issue(test, &tb, t, src, dst, now++);
+	}
+
+	for (src = 1; src <= 10; src++)
+		KUNIT_EXPECT_EQ(test, queue_length(&tb.queue[src - 1]),
+				10 * 4);
+
+	while (building_sweep(test, &tb, &now) > 0 && ++sweeps < 1000)
+		;
+
+	KUNIT_EXPECT_LT(test, sweeps, 1000);
+	building_drained(test, &tb);
+	building_free(&tb);
+}
+
+
+static struct kunit_case elevator_dispatch_cases[] =
+{
+	KUNIT_CASE(trip_count_keeps_masks),
+	KUNIT_CASE(nearest_calls),
+	KUNIT_CASE(group_fit_by_units_and_weight),
+	KUNIT_CASE(load_adjust_carries_halves),
+	KUNIT_CASE(split_group_shares_spread),
+	KUNIT_CASE(next_floors),
+	KUNIT_CASE(plan_direction_honours_starved),
+	KUNIT_CASE(starved_floor_in_issue_order),
+	KUNIT_CASE(run_and_dwell_times),
+	KUNIT_CASE(eta_sweep_up_and_back),
+	KUNIT_CASE(synthetic_sets),
+	KUNIT_CASE(queue_group_joins_trips),
+	KUNIT_CASE(walks_deliver_everyone_once),
+	KUNIT_CASE(walks_stay_within_bound),
+	{}
+};
+
+static struct kunit_suite elevator_dispatch_suite =
+{
+	.name = "elevator_dispatch",
+	.test_cases = elevator_dispatch_cases,
+};
+
+kunit_test_suite(elevator_dispatch_suite);
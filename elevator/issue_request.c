@@ -1,17 +1,23 @@
 #include <linux/linkage.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/syscalls.h>
 
-/* System call stub */
-int (*STUB_issue_request)(int, int, int) = NULL;
-EXPORT_SYMBOL(STUB_issue_request);
+#include "elevator_ops.h"
 
-/* System call wrapper */
-asmlinkage int sys_issue_request(int p_type, int start_floor,
-								 int dest_floor)
+/* System call wrapper; dispatches to the registered elevator module */
+SYSCALL_DEFINE4(issue_request, int, building, int, p_type,
+				int, start_floor, int, dest_floor)
 {
-	if (STUB_issue_request != NULL)
-		return STUB_issue_request(p_type, start_floor, dest_floor);
-	else
+	const struct elevator_ops * ops = elevator_ops_get();
+	int ret;
+
+	if (ops == NULL)
 		return -ENOSYS;
+
+	ret = static_call(elevator_issue)(building, p_type, start_floor,
+					  dest_floor);
+	elevator_ops_put(ops);
+
+	return ret;
 }
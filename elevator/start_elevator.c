@@ -1,16 +1,21 @@
 #include <linux/linkage.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/syscalls.h>
 
-/* System call stub */
-int (*STUB_start_elevator)(void) = NULL;
-EXPORT_SYMBOL(STUB_start_elevator);
+#include "elevator_ops.h"
 
-/* System call wrapper */
-asmlinkage int sys_start_elevator(void)
+/* System call wrapper; dispatches to the registered elevator module */
+SYSCALL_DEFINE1(start_elevator, int, building)
 {
-	if (STUB_start_elevator != NULL)
-		return STUB_start_elevator();
-	else
+	const struct elevator_ops * ops = elevator_ops_get();
+	int ret;
+
+	if (ops == NULL)
 		return -ENOSYS;
+
+	ret = static_call(elevator_start)(building);
+	elevator_ops_put(ops);
+
+	return ret;
 }
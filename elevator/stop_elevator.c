@@ -1,16 +1,21 @@
 #include <linux/linkage.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/syscalls.h>
 
-/* System call stub */
-int (*STUB_stop_elevator)(void) = NULL;
-EXPORT_SYMBOL(STUB_stop_elevator);
+#include "elevator_ops.h"
 
-/* System call wrapper */
-asmlinkage int sys_stop_elevator(void)
+/* System call wrapper; dispatches to the registered elevator module */
+SYSCALL_DEFINE1(stop_elevator, int, building)
 {
-	if (STUB_stop_elevator != NULL)
-		return STUB_stop_elevator();
-	else
+	const struct elevator_ops * ops = elevator_ops_get();
+	int ret;
+
+	if (ops == NULL)
 		return -ENOSYS;
+
+	ret = static_call(elevator_stop)(building);
+	elevator_ops_put(ops);
+
+	return ret;
 }
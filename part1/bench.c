@@ -0,0 +1,165 @@
+#include "bench.h"
+
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+const char * cost_unit = "cycles";
+
+uint64_t cost_now(void)
+{
+	// the fence keeps rdtsc from running ahead of the instructions
+	// before it; rdtscp would too, but some hypervisors trap it
+	_mm_lfence();
+	return __rdtsc();
+}
+#else
+const char * cost_unit = "ns";
+
+uint64_t cost_now(void)
+{
+	return now_ns();
+}
+#endif
+
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+uint64_t cost_overhead(void)
+{
+	uint64_t best = UINT64_MAX;
+	uint64_t start;
+	uint64_t cost;
+	int i;
+
+	for (i = 0; i < 1000; i++)
+	{
+		start = cost_now();
+		cost = cost_now() - start;
+		if (cost < best)
+			best = cost;
+	}
+
+	return best;
+}
+
+
+static int compare_u64(const void * a, const void * b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+void cost_summarize(uint64_t * samples, long n, struct cost_summary * s)
+{
+	memset(s, 0, sizeof(*s));
+	if (n == 0)
+		return;
+
+	qsort(samples, n, sizeof(*samples), compare_u64);
+
+	s->min = samples[0];
+	s->median = samples[n / 2];
+	s->p99 = samples[(n * 99 - 1) / 100];
+}
+
+
+/*************************************************************************/
+
+
+static int perf_open_one(uint64_t config)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_hv = 1;
+
+	fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+	// unprivileged users may only count their own user space
+	if (fd < 0)
+	{
+		attr.exclude_kernel = 1;
+		fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	return fd;
+}
+
+
+int perf_open(struct perf_counters * p)
+{
+	memset(p, 0, sizeof(*p));
+
+	p->fd[PERF_INSTRUCTIONS] = perf_open_one(PERF_COUNT_HW_INSTRUCTIONS);
+	p->fd[PERF_CACHE_MISSES] = perf_open_one(PERF_COUNT_HW_CACHE_MISSES);
+
+	return (p->fd[PERF_INSTRUCTIONS] >= 0 ||
+		p->fd[PERF_CACHE_MISSES] >= 0) ? 0 : -1;
+}
+
+
+void perf_start(struct perf_counters * p)
+{
+	int i;
+
+	for (i = 0; i < NUM_PERF; i++)
+	{
+		if (p->fd[i] < 0 || read(p->fd[i], &p->start[i],
+					 sizeof(p->start[i])) != sizeof(p->start[i]))
+			continue;
+
+		ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+
+void perf_stop(struct perf_counters * p)
+{
+	uint64_t value;
+	int i;
+
+	for (i = 0; i < NUM_PERF; i++)
+	{
+		if (p->fd[i] < 0)
+			continue;
+
+		ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(p->fd[i], &value, sizeof(value)) == sizeof(value))
+			p->total[i] += value - p->start[i];
+	}
+}
+
+
+void perf_close(struct perf_counters * p)
+{
+	int i;
+
+	for (i = 0; i < NUM_PERF; i++)
+	{
+		if (p->fd[i] >= 0)
+			close(p->fd[i]);
+	}
+}
@@ -0,0 +1,78 @@
+#ifndef PART1_BENCH_H
+#define PART1_BENCH_H
+
+#include <stdint.h>
+
+/* Shared by the benchmark modes of syscalls.x */
+
+/* System call numbers of the elevator system calls, as in
+ * bench/common.h; override with -D if your table differs
+ */
+#ifndef __NR_START_ELEVATOR
+#define __NR_START_ELEVATOR 333
+#endif
+
+#ifndef __NR_ISSUE_REQUEST
+#define __NR_ISSUE_REQUEST 334
+#endif
+
+#ifndef __NR_STOP_ELEVATOR
+#define __NR_STOP_ELEVATOR 335
+#endif
+
+#ifndef __NR_ELEVATOR_ETA
+#define __NR_ELEVATOR_ETA 336
+#endif
+
+/* costs are counted in TSC cycles on x86 and in ns elsewhere; this
+ * names the unit for the reports
+ */
+extern const char * cost_unit;
+
+/* reads the cost clock */
+uint64_t cost_now(void);
+
+/* the smallest cost of two back-to-back cost_now() calls, to take
+ * off every sample
+ */
+uint64_t cost_overhead(void);
+
+struct cost_summary
+{
+	uint64_t min;
+	uint64_t median;
+	uint64_t p99;
+};
+
+/* sorts the n samples and summarizes them into s */
+void cost_summarize(uint64_t * samples, long n, struct cost_summary * s);
+
+/* hardware counters read around a whole loop */
+enum Perf_Counters { PERF_INSTRUCTIONS, PERF_CACHE_MISSES, NUM_PERF };
+
+struct perf_counters
+{
+	int fd[NUM_PERF];
+	uint64_t start[NUM_PERF];
+	uint64_t total[NUM_PERF];
+};
+
+/* opens the counters for this process, kernel included where the
+ * host allows it; returns 0 if at least one could be opened
+ */
+int perf_open(struct perf_counters * p);
+
+/* starts and stops counting; stopping adds to p->total */
+void perf_start(struct perf_counters * p);
+void perf_stop(struct perf_counters * p);
+
+void perf_close(struct perf_counters * p);
+
+/* monotonic clock in nanoseconds */
+uint64_t now_ns(void);
+
+/* the modes; each takes the arguments after the mode name */
+int bench_calls(int argc, char ** argv);
+int bench_spawn(int argc, char ** argv);
+
+#endif
@@ -0,0 +1,7 @@
+/* The empty program syscount.x compares against: whatever system
+ * calls it makes are the C runtime's, not the program's
+ */
+int main()
+{
+	return 0;
+}
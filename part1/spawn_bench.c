@@ -0,0 +1,349 @@
+#define _GNU_SOURCE
+
+#include "bench.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <linux/sched.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* The "spawn" mode of syscalls.x: the cost of creating a process.
+ *
+ * Each primitive below creates children one at a time, and each child
+ * exits at once; the latency of a child runs from just before it is
+ * created to just after the parent has reaped it. Every primitive runs
+ * twice, with the parent's memory small and then grown to the given
+ * size, since copying page tables is what sets fork() apart.
+ *
+ *     fork          fork() and waitpid()
+ *     vfork         vfork() and waitpid()
+ *     posix_spawn   posix_spawn() of the -e program and waitpid()
+ *     clone3        clone3() with CLONE_VM | CLONE_VFORK, x86-64 only
+ *     pthread       pthread_create() and pthread_join()
+ *
+ * usage: syscalls.x spawn [-n children] [-m large_mb] [-e program]
+ *                         [primitive ...]
+ *
+ * -m 0 skips the large run; posix_spawn also pays for an exec, which
+ * is what it is for
+ */
+
+#define DEFAULT_LARGE_MB 2048
+
+/* each primitive creates one child and waits for it; returns 0, or -1
+ * with errno set
+ */
+struct primitive
+{
+	const char * name;
+	int (*spawn)(void);
+};
+
+static char * spawn_argv[] = { "/bin/true", NULL };
+extern char ** environ;
+
+
+/*************************************************************************/
+
+
+static int spawn_fork(void)
+{
+	int status;
+	pid_t pid = fork();
+
+	if (pid == 0)
+		_exit(0);
+
+	if (pid < 0)
+		return -1;
+
+	return waitpid(pid, &status, 0) == pid ? 0 : -1;
+}
+
+
+static int spawn_vfork(void)
+{
+	int status;
+	pid_t pid = vfork();
+
+	if (pid == 0)
+		_exit(0);
+
+	if (pid < 0)
+		return -1;
+
+	return waitpid(pid, &status, 0) == pid ? 0 : -1;
+}
+
+
+static int spawn_posix(void)
+{
+	int status;
+	pid_t pid;
+
+	errno = posix_spawn(&pid, spawn_argv[0], NULL, NULL, spawn_argv,
+			    environ);
+	if (errno != 0)
+		return -1;
+
+	return waitpid(pid, &status, 0) == pid ? 0 : -1;
+}
+
+
+#if defined(__x86_64__) && defined(SYS_clone3)
+/* the child shares the parent's memory and stack, so it must not
+ * touch either: it goes straight from the clone3 system call to exit
+ * without returning into C
+ */
+static long clone3_exit_child(struct clone_args * args)
+{
+	long ret;
+
+	asm volatile(
+		"syscall\n\t"
+		"test %%rax, %%rax\n\t"
+		"jnz 1f\n\t"
+		"mov %[exit], %%eax\n\t"
+		"xor %%edi, %%edi\n\t"
+		"syscall\n\t"
+		"1:"
+		: "=a" (ret)
+		: "0" ((long)SYS_clone3), "D" (args), "S" (sizeof(*args)),
+		  [exit] "i" (SYS_exit)
+		: "rcx", "r11", "memory");
+
+	return ret;
+}
+
+
+static int spawn_clone3(void)
+{
+	struct clone_args args;
+	int status;
+	long pid;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = CLONE_VM | CLONE_VFORK;
+	args.exit_signal = SIGCHLD;
+
+	pid = clone3_exit_child(&args);
+	if (pid < 0)
+	{
+		errno = -pid;
+		return -1;
+	}
+
+	return waitpid(pid, &status, 0) == pid ? 0 : -1;
+}
+#else
+static int spawn_clone3(void)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
+
+static void * thread_exit(void * arg)
+{
+	return NULL;
+}
+
+
+static int spawn_pthread(void)
+{
+	pthread_t t;
+
+	errno = pthread_create(&t, NULL, thread_exit, NULL);
+	if (errno != 0)
+		return -1;
+
+	return pthread_join(t, NULL) == 0 ? 0 : -1;
+}
+
+
+static const struct primitive primitives[] =
+{
+	{ "fork", spawn_fork },
+	{ "vfork", spawn_vfork },
+	{ "posix_spawn", spawn_posix },
+	{ "clone3", spawn_clone3 },
+	{ "pthread", spawn_pthread }
+};
+
+#define NUM_PRIMITIVES ((int)(sizeof(primitives) / sizeof(primitives[0])))
+
+
+/*************************************************************************/
+
+
+/* grow_rss() maps mb megabytes and touches every page, so they are
+ * all resident; returns NULL if they could not be mapped
+ */
+static void * grow_rss(long mb)
+{
+	size_t len = (size_t)mb << 20;
+	void * p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED)
+		return NULL;
+
+	memset(p, 1, len);
+	return p;
+}
+
+
+/* run_primitive() creates n children with p and prints a line;
+ * returns 0 unless the primitive failed
+ */
+static int run_primitive(const struct primitive * p, long n, long rss_mb,
+			 uint64_t * samples)
+{
+	struct cost_summary s;
+	uint64_t start;
+	uint64_t begin;
+	uint64_t total;
+	long i;
+
+	// one untimed child faults in whatever the primitive touches
+	if (p->spawn() != 0)
+	{
+		printf("%8ld %-12s skipped (%s)\n", rss_mb, p->name,
+		       strerror(errno));
+		return errno == ENOSYS ? 0 : -1;
+	}
+
+	begin = now_ns();
+
+	for (i = 0; i < n; i++)
+	{
+		start = now_ns();
+		if (p->spawn() != 0)
+		{
+			perror(p->name);
+			return -1;
+		}
+		samples[i] = now_ns() - start;
+	}
+
+	total = now_ns() - begin;
+	cost_summarize(samples, n, &s);
+
+	printf("%8ld %-12s %8ld %10.1f %10.1f %10.1f %10.0f\n", rss_mb,
+	       p->name, n, s.min / 1000.0, s.median / 1000.0, s.p99 / 1000.0,
+	       total > 0 ? n * 1e9 / total : 0.0);
+
+	return 0;
+}
+
+
+static int selected(const char * name, int argc, char ** argv)
+{
+	int i;
+
+	if (argc == 0)
+		return 1;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], name) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+static void usage(void)
+{
+	int i;
+
+	fprintf(stderr, "usage: syscalls.x spawn [-n children] [-m large_mb] "
+		"[-e program] [primitive ...]\nprimitives:");
+
+	for (i = 0; i < NUM_PRIMITIVES; i++)
+		fprintf(stderr, " %s", primitives[i].name);
+
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+
+int bench_spawn(int argc, char ** argv)
+{
+	uint64_t * samples;
+	long large_mb = DEFAULT_LARGE_MB;
+	long n = 1000;
+	void * ballast = NULL;
+	int failed = 0;
+	int run;
+	int i;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:m:e:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'n': n = atol(optarg); break;
+			case 'm': large_mb = atol(optarg); break;
+			case 'e': spawn_argv[0] = optarg; break;
+			default: usage();
+		}
+	}
+
+	if (n <= 0 || large_mb < 0)
+		usage();
+
+	samples = malloc(sizeof(*samples) * n);
+	if (samples == NULL)
+	{
+		perror("malloc");
+		return 1;
+	}
+
+	printf("%8s %-12s %8s %10s %10s %10s %10s\n", "extra_mb", "primitive",
+	       "children", "min_us", "median_us", "p99_us", "per_sec");
+
+	// the first run is as small as the program is, the second adds
+	// large_mb of resident memory
+	for (run = 0; run < 2; run++)
+	{
+		if (run == 1)
+		{
+			if (large_mb == 0)
+				break;
+
+			ballast = grow_rss(large_mb);
+			if (ballast == NULL)
+			{
+				perror("mmap");
+				failed = 1;
+				break;
+			}
+		}
+
+		for (i = 0; i < NUM_PRIMITIVES; i++)
+		{
+			if (selected(primitives[i].name, argc - optind, argv + optind) &&
+			    run_primitive(&primitives[i], n, run ? large_mb : 0,
+					  samples) != 0)
+				failed = 1;
+		}
+	}
+
+	if (ballast != NULL)
+		munmap(ballast, (size_t)large_mb << 20);
+
+	free(samples);
+	return failed;
+}
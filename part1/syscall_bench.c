@@ -0,0 +1,429 @@
+#include "bench.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The "calls" mode of syscalls.x: the cost of single system calls.
+ *
+ * Each call below is made in a tight loop, after a warmup, timing
+ * every call on its own; the report gives the min, median and 99th
+ * percentile per call, less the cost of reading the clock. Calls
+ * that need something the host lacks (a /proc file, the elevator
+ * system calls) are skipped. The elevator calls run against a
+ * building created for the purpose and destroyed afterwards.
+ *
+ * usage: syscalls.x calls [-n iterations] [-w warmup] [-p] [call ...]
+ *
+ * -p also counts instructions and cache misses per call with
+ * perf_event; naming calls runs only those
+ */
+
+#define ELEVATOR_PROC "/proc/elevator/default/status"
+#define BUILDINGS_PROC "/proc/elevator/buildings"
+#define SCRATCH_BUILDING "syscalls_bench"
+#define SCRATCH_STATS "/proc/elevator/" SCRATCH_BUILDING "/stats"
+#define TIMED_PROC "/proc/timed"
+
+/* each call does one unit of work; returns -1 if it could not */
+struct call
+{
+	const char * name;
+	int (*usable)(void);
+	long (*run)(void);
+	int divisor;		// runs iterations / divisor, for slow calls
+};
+
+
+/*************************************************************************/
+
+
+static long run_getpid(void)
+{
+	// glibc may cache getpid(), so go to the kernel directly
+	return syscall(SYS_getpid);
+}
+
+
+static long run_nanosleep(void)
+{
+	struct timespec t = {0};
+
+	return nanosleep(&t, NULL);
+}
+
+
+static long run_fork(void)
+{
+	int status;
+	pid_t pid = fork();
+
+	if (pid == 0)
+		_exit(0);
+
+	if (pid < 0)
+		return -1;
+
+	return waitpid(pid, &status, 0) == pid ? 0 : -1;
+}
+
+
+/* proc_cycle() opens path, reads it through and closes it */
+static long proc_cycle(const char * path)
+{
+	char buf[4096];
+	ssize_t got;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+
+	do
+		got = read(fd, buf, sizeof(buf));
+	while (got > 0);
+
+	close(fd);
+	return got;
+}
+
+
+static long run_proc_elevator(void)
+{
+	return proc_cycle(ELEVATOR_PROC);
+}
+
+
+static long run_proc_timed(void)
+{
+	return proc_cycle(TIMED_PROC);
+}
+
+
+static int proc_elevator_usable(void)
+{
+	return access(ELEVATOR_PROC, R_OK) == 0;
+}
+
+
+static int proc_timed_usable(void)
+{
+	return access(TIMED_PROC, R_OK) == 0;
+}
+
+
+/* the elevator calls are timed against a scratch building of their
+ * own, so the loops leave the buildings in use alone: start and stop
+ * a building that is then already running or stopped, a request the
+ * module refuses as invalid, and the estimate for a trip from the
+ * ground floor up one
+ */
+static int scratch_handle = -1;
+
+
+static long run_start_elevator(void)
+{
+	syscall(__NR_START_ELEVATOR, scratch_handle);
+	return 0;
+}
+
+
+static long run_issue_request(void)
+{
+	syscall(__NR_ISSUE_REQUEST, scratch_handle, 0, 0, 0);
+	return 0;
+}
+
+
+static long run_elevator_eta(void)
+{
+	syscall(__NR_ELEVATOR_ETA, scratch_handle, 1, 2);
+	return 0;
+}
+
+
+static long run_stop_elevator(void)
+{
+	syscall(__NR_STOP_ELEVATOR, scratch_handle);
+	return 0;
+}
+
+
+/* buildings_write() writes one command to the buildings file */
+static int buildings_write(const char * cmd)
+{
+	int fd = open(BUILDINGS_PROC, O_WRONLY);
+	ssize_t ret;
+
+	if (fd < 0)
+		return -1;
+
+	ret = write(fd, cmd, strlen(cmd));
+	close(fd);
+
+	return ret < 0 ? -1 : 0;
+}
+
+
+/* scratch_create() creates the scratch building, or takes over one
+ * left behind by an earlier run, and reads its handle from the first
+ * line of its stats; returns 0 on success
+ */
+static int scratch_create(void)
+{
+	char line[64];
+	FILE * f;
+
+	if (buildings_write("create " SCRATCH_BUILDING) != 0 && errno != EEXIST)
+		return -1;
+
+	f = fopen(SCRATCH_STATS, "r");
+	if (f == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		if (sscanf(line, "handle: %d", &scratch_handle) == 1)
+			break;
+	}
+
+	fclose(f);
+	return scratch_handle < 0 ? -1 : 0;
+}
+
+
+/* scratch_destroy() removes the scratch building, if it was made */
+static void scratch_destroy(void)
+{
+	if (scratch_handle < 0)
+		return;
+
+	buildings_write("destroy " SCRATCH_BUILDING);
+	scratch_handle = -1;
+}
+
+
+/* on a stock kernel the elevator numbers belong to other system
+ * calls, which fail with EINVAL or ENOSYS; only the module answers
+ * an unknown building handle with ENOENT
+ */
+static int elevator_usable(void)
+{
+	if (scratch_handle >= 0)
+		return 1;
+
+	if (syscall(__NR_START_ELEVATOR, -1) != -1 || errno != ENOENT)
+		return 0;
+
+	return scratch_create() == 0;
+}
+
+
+/* elevator_eta() came after the other three, so it is probed on its
+ * own the same way
+ */
+static int eta_usable(void)
+{
+	if (syscall(__NR_ELEVATOR_ETA, -1, 1, 2) != -1 || errno != ENOENT)
+		return 0;
+
+	return elevator_usable();
+}
+
+
+static int always_usable(void)
+{
+	return 1;
+}
+
+
+static const struct call calls[] =
+{
+	{ "getpid", always_usable, run_getpid, 1 },
+	{ "nanosleep0", always_usable, run_nanosleep, 10 },
+	{ "fork_wait", always_usable, run_fork, 100 },
+	{ "proc_elevator", proc_elevator_usable, run_proc_elevator, 10 },
+	{ "proc_timed", proc_timed_usable, run_proc_timed, 10 },
+	{ "start_elevator", elevator_usable, run_start_elevator, 1 },
+	{ "issue_request", elevator_usable, run_issue_request, 1 },
+	{ "elevator_eta", eta_usable, run_elevator_eta, 1 },
+	{ "stop_elevator", elevator_usable, run_stop_elevator, 1 }
+};
+
+#define NUM_CALLS ((int)(sizeof(calls) / sizeof(calls[0])))
+
+
+/*************************************************************************/
+
+
+/* time_call() runs c warmup times untimed, then iters times into
+ * samples; returns how many samples were taken
+ */
+static long time_call(const struct call * c, long iters, long warmup,
+		      uint64_t * samples, uint64_t overhead,
+		      struct perf_counters * perf)
+{
+	uint64_t start;
+	uint64_t cost;
+	long i;
+
+	for (i = 0; i < warmup; i++)
+		c->run();
+
+	if (perf != NULL)
+		perf_start(perf);
+
+	for (i = 0; i < iters; i++)
+	{
+		start = cost_now();
+		c->run();
+		cost = cost_now() - start;
+
+		samples[i] = cost > overhead ? cost - overhead : 0;
+	}
+
+	if (perf != NULL)
+		perf_stop(perf);
+
+	return iters;
+}
+
+
+static int selected(const char * name, int argc, char ** argv)
+{
+	int i;
+
+	if (argc == 0)
+		return 1;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], name) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+static void usage(void)
+{
+	int i;
+
+	fprintf(stderr, "usage: syscalls.x calls [-n iterations] [-w warmup] "
+		"[-p] [call ...]\ncalls:");
+
+	for (i = 0; i < NUM_CALLS; i++)
+		fprintf(stderr, " %s", calls[i].name);
+
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+
+int bench_calls(int argc, char ** argv)
+{
+	struct perf_counters perf;
+	struct perf_counters * use_perf = NULL;
+	struct cost_summary s;
+	uint64_t * samples;
+	uint64_t overhead;
+	long iters = 100000;
+	long warmup = -1;
+	long n;
+	long w;
+	int i;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:w:ph")) != -1)
+	{
+		switch (c)
+		{
+			case 'n': iters = atol(optarg); break;
+			case 'w': warmup = atol(optarg); break;
+			case 'p': use_perf = &perf; break;
+			default: usage();
+		}
+	}
+
+	if (iters <= 0)
+		usage();
+
+	// a tenth of the run warms up unless told otherwise
+	if (warmup < 0)
+		warmup = iters / 10;
+
+	if (use_perf != NULL && perf_open(use_perf) != 0)
+	{
+		perror("perf_event_open");
+		use_perf = NULL;
+	}
+
+	samples = malloc(sizeof(*samples) * iters);
+	if (samples == NULL)
+	{
+		perror("malloc");
+		return 1;
+	}
+
+	overhead = cost_overhead();
+
+	printf("%-16s %8s %10s %10s %10s", "call", "calls", "min", "median",
+	       "p99");
+	if (use_perf != NULL)
+		printf(" %12s %12s", "instructions", "cache_misses");
+	printf("   (%s per call)\n", cost_unit);
+
+	for (i = 0; i < NUM_CALLS; i++)
+	{
+		if (!selected(calls[i].name, argc - optind, argv + optind))
+			continue;
+
+		if (!calls[i].usable())
+		{
+			printf("%-16s skipped\n", calls[i].name);
+			continue;
+		}
+
+		n = iters / calls[i].divisor;
+		w = warmup / calls[i].divisor;
+		if (n == 0)
+			n = 1;
+
+		if (use_perf != NULL)
+		{
+			perf.total[PERF_INSTRUCTIONS] = 0;
+			perf.total[PERF_CACHE_MISSES] = 0;
+		}
+
+		n = time_call(&calls[i], n, w, samples, overhead, use_perf);
+		cost_summarize(samples, n, &s);
+
+		printf("%-16s %8ld %10llu %10llu %10llu", calls[i].name, n,
+		       (unsigned long long)s.min, (unsigned long long)s.median,
+		       (unsigned long long)s.p99);
+
+		if (use_perf != NULL)
+		{
+			printf(" %12llu %12llu",
+			       (unsigned long long)(perf.total[PERF_INSTRUCTIONS] / n),
+			       (unsigned long long)(perf.total[PERF_CACHE_MISSES] / n));
+		}
+
+		printf("\n");
+	}
+
+	scratch_destroy();
+
+	if (use_perf != NULL)
+		perf_close(use_perf);
+
+	free(samples);
+	return 0;
+}
@@ -1,19 +1,45 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "bench.h"
+
 /* Simple main program which sleeps for 1 second and prints the
  * process ID of the process generated by the fork() call.
  *
- * Makes exactly eight system calls (eight more system calls
- * than an empty program makes)
+ * Makes eight system calls more than an empty program does when
+ * run without arguments, or nine on glibc >= 2.34 (getrandom from
+ * malloc, when printf() first allocates). syscount.x checks this
+ * (make budget).
+ *
+ * With a mode name first it is a benchmark driver instead:
+ *
+ *     syscalls.x calls ...   the cost of single system calls
+ *                            (see syscall_bench.c)
+ *     syscalls.x spawn ...   the cost of creating a process
+ *                            (see spawn_bench.c)
  */
-int main()
+int main(int argc, char ** argv)
 {
 	struct timespec t = {0};
 
+	// checking argc costs no system call, so the plain run still
+	// makes eight, or nine on glibc >= 2.34 (getrandom from malloc)
+	if (argc > 1 && strcmp(argv[1], "calls") == 0)
+		return bench_calls(argc - 1, argv + 1);
+
+	if (argc > 1 && strcmp(argv[1], "spawn") == 0)
+		return bench_spawn(argc - 1, argv + 1);
+
+	if (argc > 1)
+	{
+		fprintf(stderr, "usage: %s [calls ... | spawn ...]\n", argv[0]);
+		return 1;
+	}
+
 	t.tv_sec = 1;
 	t.tv_nsec = 0L;
 
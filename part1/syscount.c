@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* System call budget checker.
+ *
+ * Runs a program and an empty baseline program under ptrace, counts
+ * the system calls each makes, and prints the difference by call.
+ * Everything the C runtime does before and after main() is in both,
+ * so the difference is what the program itself costs. It is meant to
+ * keep claims such as syscalls.x making eight system calls (nine on
+ * glibc >= 2.34) honest, and to catch system calls creeping into the
+ * load generators.
+ *
+ * usage: syscount.x [-b baseline] [-B budget] [-f] [-q] program [arg ...]
+ *
+ * -b is the baseline program (./empty.x), -B the most extra system
+ * calls allowed, -f also counts the program's children and threads,
+ * -q only prints the totals
+ *
+ * Exits with status 1 if the budget was exceeded and 2 if the
+ * programs could not be traced.
+ */
+
+#define MAX_SYSCALLS 1024
+
+/* names by number, from the build's <sys/syscall.h> */
+static const char * syscall_names[MAX_SYSCALLS] =
+{
+#include "syscall_names.h"
+};
+
+struct syscall_count
+{
+	long total;
+	long by_nr[MAX_SYSCALLS];
+};
+
+
+/*************************************************************************/
+
+
+/* trace() runs argv under ptrace and counts its system calls into c,
+ * those of its descendants too if follow is set; returns 0 on success
+ */
+static int trace(char ** argv, int follow, struct syscall_count * c)
+{
+	struct __ptrace_syscall_info info;
+	long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL;
+	int status;
+	int live = 1;
+	int sig;
+	pid_t child;
+	pid_t pid;
+
+	memset(c, 0, sizeof(*c));
+
+	if (follow)
+		options |= PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+			   PTRACE_O_TRACECLONE;
+
+	child = fork();
+	if (child < 0)
+		return -1;
+
+	if (child == 0)
+	{
+		// stop so the tracer can set its options before the exec
+		ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+		raise(SIGSTOP);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+
+	if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status) ||
+	    ptrace(PTRACE_SETOPTIONS, child, NULL, (void *)options) != 0)
+	{
+		kill(child, SIGKILL);
+		return -1;
+	}
+
+	ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+
+	while (live > 0)
+	{
+		pid = waitpid(-1, &status, __WALL);
+		if (pid < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+		{
+			live--;
+
+			if (pid == child && WIFEXITED(status) &&
+			    WEXITSTATUS(status) == 127)
+				fprintf(stderr, "could not run %s\n", argv[0]);
+
+			continue;
+		}
+
+		sig = 0;
+
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+		{
+			// count each call once, when it is entered
+			if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info),
+				   &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY)
+			{
+				c->total++;
+				if (info.entry.nr < MAX_SYSCALLS)
+					c->by_nr[info.entry.nr]++;
+			}
+		}
+		else if (status >> 16 == PTRACE_EVENT_FORK ||
+			 status >> 16 == PTRACE_EVENT_VFORK ||
+			 status >> 16 == PTRACE_EVENT_CLONE)
+		{
+			// the new task starts traced, and is waited for too
+			live++;
+		}
+		else if (WSTOPSIG(status) != SIGTRAP &&
+			 WSTOPSIG(status) != SIGSTOP)
+		{
+			// pass genuine signals on to the program
+			sig = WSTOPSIG(status);
+		}
+
+		ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)sig);
+	}
+
+	return 0;
+}
+
+
+static const char * syscall_name(int nr, char * buf, size_t len)
+{
+	if (nr < MAX_SYSCALLS && syscall_names[nr] != NULL)
+		return syscall_names[nr];
+
+	snprintf(buf, len, "syscall_%d", nr);
+	return buf;
+}
+
+
+static void usage(const char * prog)
+{
+	fprintf(stderr, "usage: %s [-b baseline] [-B budget] [-f] [-q] "
+		"program [arg ...]\n", prog);
+	exit(2);
+}
+
+
+int main(int argc, char ** argv)
+{
+	static struct syscall_count target;
+	static struct syscall_count base;
+	char * base_argv[] = { "./empty.x", NULL };
+	char name[32];
+	long budget = -1;
+	long delta;
+	int follow = 0;
+	int quiet = 0;
+	int nr;
+	int c;
+
+	// options end at the program, whose own options are its business
+	while ((c = getopt(argc, argv, "+b:B:fqh")) != -1)
+	{
+		switch (c)
+		{
+			case 'b': base_argv[0] = optarg; break;
+			case 'B': budget = atol(optarg); break;
+			case 'f': follow = 1; break;
+			case 'q': quiet = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (optind >= argc)
+		usage(argv[0]);
+
+	if (trace(base_argv, follow, &base) != 0 ||
+	    trace(argv + optind, follow, &target) != 0)
+	{
+		perror("ptrace");
+		return 2;
+	}
+
+	if (!quiet)
+	{
+		printf("%5s %-20s %8s %8s %6s\n", "nr", "name", "program",
+		       "baseline", "delta");
+
+		for (nr = 0; nr < MAX_SYSCALLS; nr++)
+		{
+			if (target.by_nr[nr] == base.by_nr[nr])
+				continue;
+
+			printf("%5d %-20s %8ld %8ld %+6ld\n", nr,
+			       syscall_name(nr, name, sizeof(name)), target.by_nr[nr],
+			       base.by_nr[nr], target.by_nr[nr] - base.by_nr[nr]);
+		}
+	}
+
+	delta = target.total - base.total;
+	printf("%s: %ld system calls, baseline %ld, delta %+ld", argv[optind],
+	       target.total, base.total, delta);
+
+	if (budget < 0)
+	{
+		printf("\n");
+		return 0;
+	}
+
+	printf(", budget %ld: %s\n", budget, delta <= budget ? "ok" : "OVER");
+	return delta <= budget ? 0 : 1;
+}
@@ -1,131 +1,304 @@
 #include <linux/fs.h>
+#include <linux/gfp.h>
+#include <linux/hrtimer.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/math64.h>
 #include <linux/proc_fs.h>
-#include <linux/slab.h>
+#include <linux/seq_file.h>
 #include <linux/string.h>
-#include <linux/time.h>
+#include <linux/time64.h>
+#include <linux/timekeeping.h>
 #include <linux/uaccess.h>
+#include <linux/version.h>
+
+#include "my_xtime.h"
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Simple module featuring proc read");
 
+/* /proc entries are registered with a struct proc_ops from 5.6 on */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+typedef struct proc_ops proc_fops_t;
+#define SET_PROC_FOPS(f, o, r, rel) \
+	do { \
+		(f).proc_open = (o); \
+		(f).proc_read = (r); \
+		(f).proc_release = (rel); \
+	} while (0)
+#define SET_PROC_MMAP(f, m) ((f).proc_mmap = (m))
+#define SET_PROC_LSEEK(f, l) ((f).proc_lseek = (l))
+#else
+typedef struct file_operations proc_fops_t;
+#define SET_PROC_FOPS(f, o, r, rel) \
+	do { \
+		(f).open = (o); \
+		(f).read = (r); \
+		(f).release = (rel); \
+	} while (0)
+#define SET_PROC_MMAP(f, m) ((f).mmap = (m))
+#define SET_PROC_LSEEK(f, l) ((f).llseek = (l))
+#endif
+
 #define ENTRY_NAME "timed"
-#define ENTRY_SIZE 65
 #define PERMS 0644
 #define PARENT NULL
-static struct file_operations fops;
+static proc_fops_t fops;
 
-static char * message;
-static int read_p;
-static struct timespec currentTime;
+/* the time page (see my_xtime.h), rewritten every update_us by
+ * page_timer; processes map it read-only from /proc/timed_page
+ */
+#define PAGE_PERMS 0444
+static proc_fops_t page_fops;
+static struct xtime_page * time_page;
+static struct hrtimer page_timer;
 
+static unsigned int update_us = 1000;
+module_param(update_us, uint, 0644);
+MODULE_PARM_DESC(update_us, "How often the time page is rewritten (us)");
 
-/* time_proc_open() modifies the message variable so that it
- * contains the current amount of time since the epoch, and
- * is additionally updated with the elapsed time since the last call
+/* update_us is clamped to at least this, so the timer cannot take
+ * over the CPU
  */
-int time_proc_open(struct inode *sp_inode, struct file *sp_file)
+#define MIN_UPDATE_US 10
+
+/* the clocks sampled on every open, in the order they are read */
+enum Samples
 {
-	struct timespec t;
-	long int secs;
-	long int nsecs;
+	SAMPLE_REAL,
+	SAMPLE_MONO,
+	SAMPLE_MONO_RAW,
+	SAMPLE_BOOT,
+	SAMPLE_TAI,
+	NUM_SAMPLES
+};
 
-	char * buf = kmalloc (sizeof(char) * 100, __GFP_RECLAIM);	
-	if (buf == NULL)
-	{
-		printk(KERN_WARNING "print_time");
-		return -ENOMEM;
-	}
+static const char * clock_names[NUM_SAMPLES] =
+{
+	"realtime", "monotonic", "monotonic_raw", "boottime", "tai"
+};
 
 
-	t = current_kernel_time();
+/* sample_clocks() reads every clock back to back into t; returns
+ * how long the reads took, in ns of CLOCK_MONOTONIC
+ */
+u64 sample_clocks(struct timespec64 * t)
+{
+	u64 start = ktime_get_ns();
 
-	printk(KERN_INFO "proc called open\n");
-	
-	read_p = 1;
-	message = kmalloc(sizeof(char) * ENTRY_SIZE,
-			 __GFP_RECLAIM | __GFP_IO | __GFP_FS);
+	ktime_get_real_ts64(&t[SAMPLE_REAL]);
+	ktime_get_ts64(&t[SAMPLE_MONO]);
+	ktime_get_raw_ts64(&t[SAMPLE_MONO_RAW]);
+	ktime_get_boottime_ts64(&t[SAMPLE_BOOT]);
+	ktime_get_clocktai_ts64(&t[SAMPLE_TAI]);
+
+	return ktime_get_ns() - start;
+}
 
-	if (message == NULL)
-	{
-		printk(KERN_WARNING "time_proc_open");
-		return -ENOMEM;
-	}
 
-	strcpy(message, "");
+/* time_proc_show() prints the current amount of time since the
+ * epoch and the elapsed time since the file was last read through
+ * this descriptor; every clock in clock_names follows, sampled back
+ * to back, with the time the sampling took, so the clocks can be
+ * compared for skew
+ */
+int time_proc_show(struct seq_file *m, void *v)
+{
+	struct timespec64 t[NUM_SAMPLES];
+	unsigned long last;
+	u64 sample_ns;
+	u64 elapsed;
+	u64 now;
+	u32 nsecs;
+	int i;
 
-	sprintf(buf, "current time: %ld.%09ld\n", t.tv_sec, t.tv_nsec);
-	strcat(message, buf);
+	sample_ns = sample_clocks(t);
+	now = timespec64_to_ns(&t[SAMPLE_MONO]);
 
-	if (currentTime.tv_sec)
+	seq_printf(m, "current time: %lld.%09ld\n",
+		   (long long)t[SAMPLE_REAL].tv_sec, t[SAMPLE_REAL].tv_nsec);
+
+	last = (unsigned long)m->private;
+	m->private = (void *)(unsigned long)now;
+	if (last != 0)
 	{
-		secs = t.tv_sec - currentTime.tv_sec;
-		if (t.tv_nsec - currentTime.tv_nsec < 0)	
-		{
-			nsecs = t.tv_nsec - 
-				currentTime.tv_nsec + 1000000000;
-			secs--;
-		}
-		else
-			nsecs = t.tv_nsec - currentTime.tv_nsec;
-
-
-		sprintf(buf, "elapsed time: %ld.%09ld\n", secs, nsecs);
-		strcat(message, buf);
+		elapsed = (unsigned long)now - last;
+		seq_printf(m, "elapsed time: %llu.%09u\n",
+			   div_u64_rem(elapsed, NSEC_PER_SEC, &nsecs), nsecs);
 	}
 
-	currentTime = current_kernel_time();
+	for (i = 0; i < NUM_SAMPLES; i++)
+	{
+		seq_printf(m, "%s: %lld.%09ld\n", clock_names[i],
+			   (long long)t[i].tv_sec, t[i].tv_nsec);
+	}
+
+	seq_printf(m, "sample_ns: %llu\n", sample_ns);
 
 	return 0;
 }
 
 
-/* time_proc_read() copies the contents of message to
- * the /proc/timed entry
- */ 
-ssize_t time_proc_read(struct file *sp_file, char __user *buf,
-		       		   size_t size, loff_t *offset)
+/* /proc/timed is one record, shown afresh every time it is read from
+ * the start, so a poller can pread() an open descriptor
+ */
+void * time_seq_start(struct seq_file *m, loff_t *pos)
 {
-	int len = strlen(message);
-	
-	read_p = !read_p;
-	if (read_p)
-		return 0;
+	return *pos == 0 ? SEQ_START_TOKEN : NULL;
+}
+
+
+void * time_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return NULL;
+}
 
-	printk(KERN_INFO "proc called read\n");
 
-	copy_to_user(buf, message, len);
-	return len;
+void time_seq_stop(struct seq_file *m, void *v)
+{
 }
 
 
-/* time_proc_release() frees the message variable and
- * releases the /proc/timed entry
+static const struct seq_operations time_seq_ops =
+{
+	.start = time_seq_start,
+	.next = time_seq_next,
+	.stop = time_seq_stop,
+	.show = time_proc_show,
+};
+
+
+/* time_proc_open() attaches the seq_file; the record itself is
+ * formatted on read. The seq_file's private pointer doubles as the
+ * descriptor's baseline, the CLOCK_MONOTONIC ns of its last read, so
+ * nothing else is allocated: seq_open() zeroes it, and seq_read()
+ * holds the seq_file's lock around show. On 32-bit only the low
+ * bits fit, and intervals over about 4 s wrap
  */
-int time_proc_release(struct inode *sp_inode, struct file *sp_file)
+int time_proc_open(struct inode *sp_inode, struct file *sp_file)
+{
+	return seq_open(sp_file, &time_seq_ops);
+}
+
+
+/*************************************************************************/
+
+
+/* page_update() rewrites the time page; only page_timer calls it
+ * once the page is published, so there is a single writer
+ */
+void page_update(void)
+{
+	u64 mono = ktime_get_ns();
+	u64 real = ktime_get_real_ns();
+	u32 seq = time_page->seq;
+
+	WRITE_ONCE(time_page->seq, seq + 1);
+	smp_wmb();
+
+	WRITE_ONCE(time_page->update_us, max(READ_ONCE(update_us),
+					     (unsigned int)MIN_UPDATE_US));
+	if (time_page->monotonic_ns)
+		WRITE_ONCE(time_page->delta_ns, mono - time_page->monotonic_ns);
+	WRITE_ONCE(time_page->realtime_ns, real);
+	WRITE_ONCE(time_page->monotonic_ns, mono);
+	WRITE_ONCE(time_page->updates, time_page->updates + 1);
+
+	smp_wmb();
+	WRITE_ONCE(time_page->seq, seq + 2);
+}
+
+
+/* page_timer_fn() rewrites the page and rearms the timer at the
+ * current update_us, so the rate can be changed while loaded
+ */
+enum hrtimer_restart page_timer_fn(struct hrtimer * timer)
+{
+	page_update();
+
+	hrtimer_forward_now(timer,
+		ns_to_ktime((u64)time_page->update_us * NSEC_PER_USEC));
+
+	return HRTIMER_RESTART;
+}
+
+
+/* time_page_mmap() maps the time page into a process, read-only */
+int time_page_mmap(struct file *sp_file, struct vm_area_struct *vma)
+{
+	if (vma->vm_end - vma->vm_start != PAGE_SIZE || vma->vm_pgoff != 0)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	// the mapping holds a reference on the page, so it outlives the
+	// module in a process that still has it mapped
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(time_page));
+}
+
+
+/* time_page_open() lets the page be opened for mapping; it has
+ * nothing to read
+ */
+int time_page_open(struct inode *sp_inode, struct file *sp_file)
 {
-	printk(KERN_NOTICE "proc called release\n");
-	kfree(message);
 	return 0;
 }
 
 
-/* time_init() sets fops.open, fops.read, and fops.release, as
+/*************************************************************************/
+
+
+/* time_init() points fops at the seq_file handlers, as
  * well as creating the file /proc/timed
  */
 static int time_init(void)
 {
 	printk(KERN_NOTICE "/proc/%s create\n",ENTRY_NAME);
-	fops.open = time_proc_open;
-	fops.read = time_proc_read;
-	fops.release = time_proc_release;
+	SET_PROC_FOPS(fops, time_proc_open, seq_read, seq_release);
+	SET_PROC_LSEEK(fops, seq_lseek);
+	SET_PROC_FOPS(page_fops, time_page_open, NULL, NULL);
+	SET_PROC_MMAP(page_fops, time_page_mmap);
+
+	time_page = (struct xtime_page *)get_zeroed_page(GFP_KERNEL);
+	if (time_page == NULL)
+	{
+		pr_warn("my_xtime: time page allocation failed\n");
+		return -ENOMEM;
+	}
+
+	page_update();
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+	hrtimer_setup(&page_timer, page_timer_fn, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&page_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	page_timer.function = page_timer_fn;
+#endif
+	hrtimer_start(&page_timer,
+		      ns_to_ktime((u64)time_page->update_us * NSEC_PER_USEC),
+		      HRTIMER_MODE_REL);
 	
-	if (!proc_create(ENTRY_NAME, PERMS, NULL, &fops))
+	if (!proc_create(ENTRY_NAME, PERMS, NULL, &fops) ||
+	    !proc_create(XTIME_PAGE_NAME, PAGE_PERMS, NULL, &page_fops))
 	{
-		printk(KERN_WARNING "proc create\n");
+		pr_warn("my_xtime: proc create failed\n");
 		remove_proc_entry(ENTRY_NAME, NULL);
+		hrtimer_cancel(&page_timer);
+		free_page((unsigned long)time_page);
 		return -ENOMEM;
 	}
 	
@@ -137,7 +310,13 @@ module_init(time_init);
 /* time_exit() removes the my_xtime module and the /proc/timed entry */ 
 static void time_exit(void)
 {
+	remove_proc_entry(XTIME_PAGE_NAME, NULL);
 	remove_proc_entry(ENTRY_NAME, NULL);
+
+	// processes that still map the page keep it, frozen, until they
+	// unmap it; the timer must stop writing it first
+	hrtimer_cancel(&page_timer);
+	free_page((unsigned long)time_page);
 	printk(KERN_NOTICE "Removing /proc/%s\n", ENTRY_NAME);
 }
 module_exit(time_exit);
@@ -0,0 +1,65 @@
+#ifndef MY_XTIME_H
+#define MY_XTIME_H
+
+/* my_xtime publishes the time in one read-only page that processes
+ * map from /proc/timed_page, so reading it costs a few loads instead
+ * of an open, a read and a close. An hrtimer rewrites the page every
+ * update_us microseconds (a module parameter).
+ *
+ * seq is odd while the page is being rewritten; a reader that sees
+ * the same even seq before and after copying the other fields has a
+ * consistent snapshot. xtime_page_read() below does exactly that.
+ *
+ * This header is shared with userspace, so it only holds the layout
+ * and the reader.
+ */
+
+#include <linux/types.h>
+
+#define XTIME_PAGE_NAME "timed_page"
+
+struct xtime_page
+{
+	__u32 seq;
+	__u32 update_us;	// the rate the page is rewritten at
+	__u64 realtime_ns;	// CLOCK_REALTIME at the last update
+	__u64 monotonic_ns;	// CLOCK_MONOTONIC at the last update
+	__u64 delta_ns;		// CLOCK_MONOTONIC since the update before
+	__u64 updates;		// updates since the module was loaded
+};
+
+#ifndef __KERNEL__
+
+/* xtime_page_read() copies a consistent snapshot of page into snap */
+static inline void xtime_page_read(const struct xtime_page * page,
+				   struct xtime_page * snap)
+{
+	__u32 seq;
+
+	do
+	{
+		while ((seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE)) & 1)
+			;
+
+		snap->update_us = __atomic_load_n(&page->update_us,
+						  __ATOMIC_RELAXED);
+		snap->realtime_ns = __atomic_load_n(&page->realtime_ns,
+						    __ATOMIC_RELAXED);
+		snap->monotonic_ns = __atomic_load_n(&page->monotonic_ns,
+						     __ATOMIC_RELAXED);
+		snap->delta_ns = __atomic_load_n(&page->delta_ns,
+						 __ATOMIC_RELAXED);
+		snap->updates = __atomic_load_n(&page->updates,
+						__ATOMIC_RELAXED);
+
+		// the field loads must complete before seq is read again
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	}
+	while (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq);
+
+	snap->seq = seq;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,427 @@
+#include <linux/bitops.h>
+#include <linux/delay.h>
+#include <linux/err.h>
+#include <linux/hrtimer.h>
+#include <linux/init.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/proc_fs.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Measures how late timed wakeups fire");
+
+/* /proc entries are registered with a struct proc_ops from 5.6 on */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+typedef struct proc_ops proc_fops_t;
+#define SET_PROC_FOPS(f, o, r, rel) \
+	do { \
+		(f).proc_open = (o); \
+		(f).proc_read = (r); \
+		(f).proc_release = (rel); \
+	} while (0)
+#define SET_PROC_LSEEK(f, l) ((f).proc_lseek = (l))
+#else
+typedef struct file_operations proc_fops_t;
+#define SET_PROC_FOPS(f, o, r, rel) \
+	do { \
+		(f).open = (o); \
+		(f).read = (r); \
+		(f).release = (rel); \
+	} while (0)
+#define SET_PROC_LSEEK(f, l) ((f).llseek = (l))
+#endif
+
+/* /proc/timer_latency shows, for every way of waiting below, how late
+ * its wakeups fired compared with when they were due
+ */
+#define ENTRY_NAME "timer_latency"
+#define PERMS 0444
+static proc_fops_t fops;
+
+/* the ways of waiting that are measured; the hrtimer fires from
+ * interrupt context, the others each sleep in a kthread of their own
+ */
+enum Methods
+{
+	METHOD_HRTIMER,
+	METHOD_MSLEEP,
+	METHOD_USLEEP,
+	METHOD_TIMEOUT,
+	NUM_METHODS
+};
+
+static const char * method_names[NUM_METHODS] =
+{
+	"hrtimer", "msleep", "usleep_range", "schedule_timeout"
+};
+
+/* the interval of each method, read again before every wait so a
+ * change applies at once; 0 pauses a method
+ */
+static unsigned int hrtimer_us = 1000;
+module_param(hrtimer_us, uint, 0644);
+MODULE_PARM_DESC(hrtimer_us,
+		 "Period of the hrtimer (us, at least 50, 0: paused)");
+
+/* a nonzero hrtimer_us is clamped to at least this, so the timer
+ * cannot take over the CPU
+ */
+#define MIN_HRTIMER_US 50
+
+static unsigned int msleep_ms = 10;
+module_param(msleep_ms, uint, 0644);
+MODULE_PARM_DESC(msleep_ms,
+		 "msleep() interval (ms, at most 1000, 0: paused)");
+
+static unsigned int usleep_us = 1000;
+module_param(usleep_us, uint, 0644);
+MODULE_PARM_DESC(usleep_us,
+		 "usleep_range() lower bound (us, at most 1000000, 0: paused)");
+
+static unsigned int usleep_slack_us = 50;
+module_param(usleep_slack_us, uint, 0644);
+MODULE_PARM_DESC(usleep_slack_us,
+		 "usleep_range() upper bound above the lower one (us)");
+
+static unsigned int timeout_ms = 10;
+module_param(timeout_ms, uint, 0644);
+MODULE_PARM_DESC(timeout_ms, "schedule_timeout() interval (ms, 0: paused)");
+
+/* msleep() and usleep_range() sleep through kthread_stop(), so
+ * their intervals, slack included, are capped to this; it bounds how
+ * long rmmod waits for a sleeper
+ */
+#define MAX_SLEEP_US 1000000
+
+/* a paused method checks for a new interval this often */
+#define PAUSE_MS 100
+
+/* lateness is binned like the elevator's jitter file: bucket 0 holds
+ * wakeups under 1 us late, bucket i those 2^(i-1) to 2^i us late, and
+ * the last one everything later
+ */
+#define LAT_BUCKETS 24
+
+/* each method's record has a single writer (its hrtimer callback or
+ * kthread); readers may see one wakeup counted in some fields and not
+ * yet in others, which the summaries tolerate
+ */
+struct lat_record
+{
+	u64 wakeups;
+	u64 late_ns;
+	u64 max_ns;
+	u64 hist[LAT_BUCKETS];
+};
+
+static struct lat_record records[NUM_METHODS];
+static struct hrtimer lat_timer;
+static struct task_struct * sleepers[NUM_METHODS];
+
+
+/*************************************************************************/
+
+
+/* lat_record() counts a wakeup of method that was due at due_ns */
+void lat_record(int method, u64 due_ns)
+{
+	struct lat_record * r = &records[method];
+	u64 now = ktime_get_ns();
+	u64 late = now > due_ns ? now - due_ns : 0;
+	int bucket = min(fls64(div_u64(late, NSEC_PER_USEC)), LAT_BUCKETS - 1);
+
+	WRITE_ONCE(r->late_ns, r->late_ns + late);
+	if (late > r->max_ns)
+		WRITE_ONCE(r->max_ns, late);
+	WRITE_ONCE(r->hist[bucket], r->hist[bucket] + 1);
+	WRITE_ONCE(r->wakeups, r->wakeups + 1);
+}
+
+
+/* lat_percentile() returns the upper edge (in us) of the bucket
+ * holding the pct-th percentile of r's wakeups, or 0 if there are none
+ */
+u64 lat_percentile(const struct lat_record * r, int pct)
+{
+	u64 total = 0;
+	u64 rank;
+	u64 seen = 0;
+	int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++)
+		total += r->hist[i];
+
+	if (total == 0)
+		return 0;
+
+	rank = div64_u64(total * pct + 99, 100);
+
+	for (i = 0; i < LAT_BUCKETS; i++)
+	{
+		seen += r->hist[i];
+		if (seen >= rank)
+			break;
+	}
+
+	return 1ULL << i;
+}
+
+
+/*************************************************************************/
+
+
+/* hrtimer_period() returns the hrtimer's period in us, hrtimer_us
+ * clamped to MIN_HRTIMER_US, or 0 while it is paused
+ */
+unsigned int hrtimer_period(void)
+{
+	unsigned int period = READ_ONCE(hrtimer_us);
+
+	return period > 0 ? max(period, (unsigned int)MIN_HRTIMER_US) : 0;
+}
+
+
+/* method_interval() returns the interval method waits for, in the
+ * unit of its parameter, after the clamps above; 0 while it is paused
+ */
+unsigned int method_interval(int method)
+{
+	switch (method)
+	{
+		case METHOD_HRTIMER:
+			return hrtimer_period();
+
+		case METHOD_MSLEEP:
+			return min(READ_ONCE(msleep_ms),
+				   (unsigned int)(MAX_SLEEP_US / USEC_PER_MSEC));
+
+		case METHOD_USLEEP:
+			return min(READ_ONCE(usleep_us), (unsigned int)MAX_SLEEP_US);
+
+		case METHOD_TIMEOUT:
+			return READ_ONCE(timeout_ms);
+	}
+
+	return 0;
+}
+
+
+/* lat_timer_fn() records how late the hrtimer fired and rearms it a
+ * period after it was due, so a late expiry does not shift the ones
+ * after it
+ */
+enum hrtimer_restart lat_timer_fn(struct hrtimer * timer)
+{
+	unsigned int period = hrtimer_period();
+
+	if (period > 0)
+		lat_record(METHOD_HRTIMER, ktime_to_ns(hrtimer_get_expires(timer)));
+
+	hrtimer_forward_now(timer, period > 0 ?
+		ns_to_ktime((u64)period * NSEC_PER_USEC) :
+		ms_to_ktime(PAUSE_MS));
+
+	return HRTIMER_RESTART;
+}
+
+
+/* lat_sleep() waits once with method; returns when it was due, or 0
+ * if the method is paused (after waiting PAUSE_MS)
+ */
+u64 lat_sleep(int method)
+{
+	unsigned int interval = method_interval(method);
+	unsigned int slack;
+	unsigned long timeout;
+	u64 start = ktime_get_ns();
+
+	if (interval == 0)
+	{
+		msleep_interruptible(PAUSE_MS);
+		return 0;
+	}
+
+	switch (method)
+	{
+		case METHOD_MSLEEP:
+		{
+			msleep(interval);
+			return start + (u64)interval * NSEC_PER_MSEC;
+		}
+
+		case METHOD_USLEEP:
+		{
+			slack = min(READ_ONCE(usleep_slack_us),
+				    MAX_SLEEP_US - interval);
+			usleep_range(interval, interval + slack);
+			return start + (u64)interval * NSEC_PER_USEC;
+		}
+
+		case METHOD_TIMEOUT:
+		{
+			// a timeout ends on a tick; the rounding up to it is part
+			// of what a caller asking for interval pays, so it counts
+			// as lateness
+			timeout = msecs_to_jiffies(interval);
+			schedule_timeout_interruptible(timeout);
+			return start + (u64)interval * NSEC_PER_MSEC;
+		}
+	}
+
+	return 0;
+}
+
+
+/* lat_sleeper() waits with one method over and over, recording each
+ * wakeup, until the module is removed
+ */
+int lat_sleeper(void * data)
+{
+	int method = (long)data;
+	u64 due;
+
+	while (!kthread_should_stop())
+	{
+		due = lat_sleep(method);
+
+		// kthread_stop() cuts schedule_timeout_interruptible()
+		// short; the other sleeps run to the end, which
+		// MAX_SLEEP_US and PAUSE_MS bound
+		if (due != 0 && !kthread_should_stop())
+			lat_record(method, due);
+	}
+
+	return 0;
+}
+
+
+/*************************************************************************/
+
+
+/* lat_proc_show() prints one line per method (its interval, wakeups,
+ * and mean, median, 99th percentile and longest lateness in us) and
+ * then the lateness histograms, one column per method
+ */
+int lat_proc_show(struct seq_file *m, void *v)
+{
+	static const char * units[NUM_METHODS] = { "us", "ms", "us", "ms" };
+	struct lat_record r;
+	int i;
+	int j;
+
+	seq_printf(m, "%-16s %10s %10s %8s %8s %8s %8s\n", "method",
+		   "interval", "wakeups", "mean_us", "p50_us", "p99_us", "max_us");
+
+	for (i = 0; i < NUM_METHODS; i++)
+	{
+		r = records[i];
+
+		seq_printf(m, "%-16s %8u%s %10llu %8llu %8llu %8llu %8llu\n",
+			   method_names[i], method_interval(i), units[i], r.wakeups,
+			   r.wakeups > 0 ?
+				div64_u64(r.late_ns, r.wakeups * NSEC_PER_USEC) : 0,
+			   lat_percentile(&r, 50), lat_percentile(&r, 99),
+			   div_u64(r.max_ns, NSEC_PER_USEC));
+	}
+
+	seq_printf(m, "\n%-10s", "le_us");
+	for (i = 0; i < NUM_METHODS; i++)
+		seq_printf(m, " %16s", method_names[i]);
+	seq_puts(m, "\n");
+
+	for (j = 0; j < LAT_BUCKETS; j++)
+	{
+		seq_printf(m, "%-10llu", 1ULL << j);
+		for (i = 0; i < NUM_METHODS; i++)
+			seq_printf(m, " %16llu", READ_ONCE(records[i].hist[j]));
+		seq_puts(m, "\n");
+	}
+
+	return 0;
+}
+
+
+int lat_proc_open(struct inode *sp_inode, struct file *sp_file)
+{
+	return single_open(sp_file, lat_proc_show, NULL);
+}
+
+
+/*************************************************************************/
+
+
+/* lat_init() starts the hrtimer and one kthread per sleeping method,
+ * and creates /proc/timer_latency
+ */
+static int lat_init(void)
+{
+	struct task_struct * t;
+	long i;
+
+	SET_PROC_FOPS(fops, lat_proc_open, seq_read, single_release);
+	SET_PROC_LSEEK(fops, seq_lseek);
+
+	for (i = METHOD_MSLEEP; i < NUM_METHODS; i++)
+	{
+		t = kthread_run(lat_sleeper, (void *)i, "timer_lat/%s",
+				method_names[i]);
+		if (IS_ERR(t))
+		{
+			printk(KERN_WARNING "timer_lat kthread\n");
+
+			while (--i >= METHOD_MSLEEP)
+				kthread_stop(sleepers[i]);
+
+			return PTR_ERR(t);
+		}
+
+		sleepers[i] = t;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+	hrtimer_setup(&lat_timer, lat_timer_fn, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&lat_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	lat_timer.function = lat_timer_fn;
+#endif
+	hrtimer_start(&lat_timer, ms_to_ktime(1), HRTIMER_MODE_REL);
+
+	if (!proc_create(ENTRY_NAME, PERMS, NULL, &fops))
+	{
+		printk(KERN_WARNING "proc create\n");
+		hrtimer_cancel(&lat_timer);
+
+		for (i = METHOD_MSLEEP; i < NUM_METHODS; i++)
+			kthread_stop(sleepers[i]);
+
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+module_init(lat_init);
+
+
+/* lat_exit() stops the timer and the kthreads and removes
+ * /proc/timer_latency
+ */
+static void lat_exit(void)
+{
+	int i;
+
+	remove_proc_entry(ENTRY_NAME, NULL);
+	hrtimer_cancel(&lat_timer);
+
+	for (i = METHOD_MSLEEP; i < NUM_METHODS; i++)
+		kthread_stop(sleepers[i]);
+}
+module_exit(lat_exit);